@@ -22,7 +22,8 @@ def main():
             if not line:
                 continue
             try:
-                term, cnt = line.split("\t", 1)
+                # term, cf and, from --mode hash, df
+                term, cnt = line.split("\t")[:2]
                 cnt = int(cnt)
             except:
                 continue
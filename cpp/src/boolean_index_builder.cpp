@@ -1,21 +1,27 @@
 #include "text_tokenizer.h"
 #include "word_stemmer.h"
 #include "fs_utils.h"
-
+#include "index_io.h"
+#include "postings_codec.h"
+#include "run_merge.h"
+#include "stem_cache.h"
+#include "term_counts.h"
+#include "term_dict.h"
+#include "token_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
-static void write_u16(std::ofstream& out, uint16_t x) { out.write(reinterpret_cast<char*>(&x), sizeof(x)); }
-static void write_u32(std::ofstream& out, uint32_t x) { out.write(reinterpret_cast<char*>(&x), sizeof(x)); }
-static void write_u64(std::ofstream& out, uint64_t x) { out.write(reinterpret_cast<char*>(&x), sizeof(x)); }
-
-static uint16_t read_u16(std::ifstream& in) { uint16_t x; in.read(reinterpret_cast<char*>(&x), sizeof(x)); return x; }
-static uint32_t read_u32(std::ifstream& in) { uint32_t x; in.read(reinterpret_cast<char*>(&x), sizeof(x)); return x; }
-
 static std::string clean_field(std::string s) {
     for (char& c : s) {
         if (c == '\t' || c == '\n' || c == '\r') c = ' ';
@@ -28,23 +34,92 @@ struct ProgramArgs {
     std::string meta_tsv;
     std::string out_dir;
     bool use_stemming = true;
+    size_t stem_cache = 0;
     uint64_t chunk_pairs = 2000000;
+    int threads = 1;
+    uint32_t format = kBidxVersionRaw;
+    bool format_given = false;
+    bool positions = false;
+    bool freqs = false;
+    bool bitmaps = false;
+    bool append = false;
+    bool merge = false;
+    int merge_factor = 4;
+    uint32_t shards = 1;
+    std::string token_stats;
+    std::string termfreq;
+    size_t tf_mem_mb = 256;
+    bool remove_docs = false;
+    std::vector<uint32_t> delete_ids;
+    std::vector<std::string> delete_urls;
 };
 
 static bool parse_args(int argc, char** argv, ProgramArgs& a) {
-    if (argc < 4) return false;
-    a.docs_list = argv[1];
-    a.meta_tsv = argv[2];
-    a.out_dir = argv[3];
+    int first_opt = 4;
+    std::string mode = argc >= 2 ? argv[1] : "";
+    if (argc >= 3 && (mode == "merge" || mode == "delete")) {
+        a.merge = (mode == "merge");
+        a.remove_docs = (mode == "delete");
+        a.out_dir = argv[2];
+        first_opt = 3;
+    } else {
+        if (argc < 4) return false;
+        a.docs_list = argv[1];
+        a.meta_tsv = argv[2];
+        a.out_dir = argv[3];
+    }
 
-    for (int i = 4; i < argc; ++i) {
+    for (int i = first_opt; i < argc; ++i) {
         std::string s = argv[i];
         if (s == "--stemming" && i + 1 < argc) {
             a.use_stemming = (std::string(argv[i + 1]) == "1");
             ++i;
+        } else if (s == "--stem_cache" && i + 1 < argc) {
+            a.stem_cache = std::stoul(argv[i + 1]);
+            ++i;
         } else if (s == "--chunk_pairs" && i + 1 < argc) {
             a.chunk_pairs = std::stoull(argv[i + 1]);
             ++i;
+        } else if (s == "--threads" && i + 1 < argc) {
+            a.threads = std::max(1, std::stoi(argv[i + 1]));
+            ++i;
+        } else if (s == "--format" && i + 1 < argc) {
+            a.format = (std::string(argv[i + 1]) == "2") ? kBidxVersionBlocked : kBidxVersionRaw;
+            a.format_given = true;
+            ++i;
+        } else if (s == "--positions" && i + 1 < argc) {
+            a.positions = (std::string(argv[i + 1]) == "1");
+            ++i;
+        } else if (s == "--freqs" && i + 1 < argc) {
+            a.freqs = (std::string(argv[i + 1]) == "1");
+            ++i;
+        } else if (s == "--bitmaps" && i + 1 < argc) {
+            a.bitmaps = (std::string(argv[i + 1]) == "1");
+            ++i;
+        } else if (s == "--append" && i + 1 < argc) {
+            a.append = (std::string(argv[i + 1]) == "1");
+            ++i;
+        } else if (s == "--shards" && i + 1 < argc) {
+            a.shards = (uint32_t)std::max(1, std::stoi(argv[i + 1]));
+            ++i;
+        } else if (s == "--token_stats" && i + 1 < argc) {
+            a.token_stats = argv[i + 1];
+            ++i;
+        } else if (s == "--termfreq" && i + 1 < argc) {
+            a.termfreq = argv[i + 1];
+            ++i;
+        } else if (s == "--tf_mem_mb" && i + 1 < argc) {
+            a.tf_mem_mb = std::max<size_t>(1, std::stoul(argv[i + 1]));
+            ++i;
+        } else if (s == "--merge_factor" && i + 1 < argc) {
+            a.merge_factor = std::max(2, std::stoi(argv[i + 1]));
+            ++i;
+        } else if (s == "--doc" && i + 1 < argc) {
+            a.delete_ids.push_back((uint32_t)std::stoul(argv[i + 1]));
+            ++i;
+        } else if (s == "--url" && i + 1 < argc) {
+            a.delete_urls.push_back(argv[i + 1]);
+            ++i;
         }
     }
     return true;
@@ -75,6 +150,7 @@ static bool split_tsv6(const std::string& line, std::string p[6]) {
 }
 
 static bool build_docs_file(const std::string& meta_tsv,
+                            uint32_t doc_base,
                             uint32_t doc_count,
                             const std::string& out_path) {
     std::vector<std::string> urls(doc_count);
@@ -92,244 +168,780 @@ static bool build_docs_file(const std::string& meta_tsv,
         std::string p[6];
         if (!split_tsv6(line, p)) continue;
 
-        int id;
-        try { id = std::stoi(p[0]); }
+        int64_t id;
+        try { id = std::stoll(p[0]); }
         catch (...) { continue; }
 
-        if (id < 0 || (uint32_t)id >= doc_count) continue;
+        if (id < (int64_t)doc_base || (uint32_t)id - doc_base >= doc_count) continue;
 
-        urls[id] = clean_field(p[1]);
-        titles[id] = clean_field(p[4]);
+        urls[id - doc_base] = clean_field(p[1]);
+        titles[id - doc_base] = clean_field(p[4]);
     }
 
-    std::ofstream out(out_path, std::ios::binary);
-    if (!out) return false;
-
-    out.write("DOCS", 4);
-    write_u32(out, 1);
-    write_u32(out, doc_count);
-
-    for (uint32_t i = 0; i < doc_count; ++i) {
-        const auto& u = urls[i];
-        const auto& t = titles[i];
-
-        uint16_t ul = static_cast<uint16_t>(std::min<size_t>(u.size(), 65535));
-        uint16_t tl = static_cast<uint16_t>(std::min<size_t>(t.size(), 65535));
-
-        write_u16(out, ul);
-        if (ul) out.write(u.data(), ul);
-
-        write_u16(out, tl);
-        if (tl) out.write(t.data(), tl);
-    }
-
-    return true;
+    return save_docs(out_path, urls, titles);
 }
 
-static bool write_run(const std::string& path, std::vector<TermDoc>& data) {
-    merge_sort_termdoc(data);
+struct TermPair {
+    uint32_t term;
+    uint32_t doc;
+};
 
-    if (!data.empty()) {
-        size_t w = 1;
-        for (size_t i = 1; i < data.size(); ++i) {
-            if (data[i].term == data[w - 1].term &&
-                data[i].doc == data[w - 1].doc) continue;
-            data[w++] = data[i];
-        }
-        data.resize(w);
+// Run layout: for every term in byte order, u16 len, term, u32 n, then n
+// ascending doc ids; with positions each doc id is followed by u32 count and
+// the positions, with term frequencies (and no positions) by u32 tf. Pairs
+// arrive in doc order, so a counting sort by term id is enough.
+static bool write_run(const std::string& path,
+                      const TermDict& dict,
+                      const std::vector<TermPair>& pairs,
+                      const PositionLists* positions,
+                      const std::vector<uint32_t>* tfs) {
+    std::vector<uint32_t> order;
+    dict.sorted_ids(order);
+
+    std::vector<size_t> pos(dict.size(), 0);
+    for (const auto& p : pairs) pos[p.term]++;
+
+    std::vector<uint32_t> counts(dict.size());
+    size_t at = 0;
+    for (uint32_t id : order) {
+        counts[id] = (uint32_t)pos[id];
+        pos[id] = at;
+        at += counts[id];
     }
 
+    std::vector<uint32_t> sorted(pairs.size());
+    for (uint32_t k = 0; k < pairs.size(); ++k) sorted[pos[pairs[k].term]++] = k;
+
     std::ofstream out(path, std::ios::binary);
     if (!out) return false;
 
-    for (const auto& td : data) {
-        uint16_t len = static_cast<uint16_t>(std::min<size_t>(td.term.size(), 65535));
+    for (uint32_t id : order) {
+        std::string_view t = dict.term(id);
+        uint16_t len = static_cast<uint16_t>(std::min<size_t>(t.size(), 65535));
         write_u16(out, len);
-        if (len) out.write(td.term.data(), len);
-        write_u32(out, td.doc);
+        if (len) out.write(t.data(), len);
+        write_u32(out, counts[id]);
+        for (size_t k = pos[id] - counts[id]; k < pos[id]; ++k) {
+            uint32_t pi = sorted[k];
+            write_u32(out, pairs[pi].doc);
+            if (tfs && !positions) write_u32(out, (*tfs)[pi]);
+            if (!positions) continue;
+            uint32_t begin = pi ? positions->ends[pi - 1] : 0;
+            uint32_t end = positions->ends[pi];
+            write_u32(out, end - begin);
+            out.write(reinterpret_cast<const char*>(positions->pos.data() + begin),
+                      (end - begin) * sizeof(uint32_t));
+        }
     }
 
-    return true;
+    return static_cast<bool>(out);
 }
 
 struct RunReader {
-    std::ifstream in;
+    BufferedReader in;
     bool valid = false;
+    bool positional = false;
+    bool freqs = false;
     std::string term;
     uint32_t doc = 0;
+    uint32_t tf = 1;
+    uint32_t left = 0;
+    std::vector<uint32_t> positions;
 
     bool open(const std::string& path) {
-        in.open(path, std::ios::binary);
         valid = false;
-        return static_cast<bool>(in);
+        left = 0;
+        return in.open(path);
     }
 
     bool next() {
-        if (!in || in.peek() == EOF) { valid = false; return false; }
-        uint16_t len;
-        in.read(reinterpret_cast<char*>(&len), sizeof(len));
-        if (!in) { valid = false; return false; }
-        term.resize(len);
-        if (len) in.read(&term[0], len);
-        doc = read_u32(in);
-        valid = static_cast<bool>(in);
+        valid = false;
+        if (left == 0) {
+            uint16_t len;
+            if (!in.read(&len, sizeof(len))) return false;
+            term.resize(len);
+            if (len && !in.read(&term[0], len)) return false;
+            if (!in.read(&left, sizeof(left)) || left == 0) return false;
+        }
+        valid = in.read(&doc, sizeof(doc));
+        --left;
+        if (valid && positional) {
+            uint32_t n;
+            valid = in.read(&n, sizeof(n));
+            positions.resize(valid ? n : 0);
+            if (valid && n) valid = in.read(positions.data(), n * sizeof(uint32_t));
+            tf = n;
+        } else if (valid && freqs) {
+            valid = in.read(&tf, sizeof(tf));
+        }
         return valid;
     }
 };
 
-struct LexEntry {
-    std::string term;
-    uint64_t offset;
-    uint32_t df;
-};
+static int cmp_runs(const RunReader& a, const RunReader& b) {
+    int c = a.term.compare(b.term);
+    if (c != 0) return c;
+    return (a.doc < b.doc) ? -1 : (a.doc > b.doc ? 1 : 0);
+}
 
 static bool merge_runs(const std::vector<std::string>& run_paths,
-                       const std::string& terms_path,
-                       const std::string& postings_path) {
+                       const std::string& dir,
+                       uint32_t format,
+                       bool positional,
+                       bool bitmaps,
+                       const std::vector<uint32_t>* doc_lens) {
     std::vector<RunReader> runs(run_paths.size());
     for (size_t i = 0; i < run_paths.size(); ++i) {
         if (!runs[i].open(run_paths[i])) return false;
+        runs[i].positional = positional;
+        runs[i].freqs = (doc_lens != nullptr);
         runs[i].next();
     }
 
-    std::ofstream postings(postings_path, std::ios::binary);
-    if (!postings) return false;
+    IndexWriter writer;
+    if (!writer.open(dir + "/postings.bin.tmp", format)) return false;
+    if (positional && !writer.open_positions(dir + "/positions.bin.tmp")) return false;
+    if (doc_lens && !writer.open_freqs(dir + "/freqs.bin.tmp", *doc_lens)) return false;
+    if (bitmaps && !writer.open_bitmaps(dir + "/bitmaps.bin.tmp")) return false;
 
-    std::vector<LexEntry> lexicon;
     std::string current_term;
     std::vector<uint32_t> postings_buf;
-    uint64_t offset = 0;
-
-    std::string last_term;
-    uint32_t last_doc = 0;
-    bool has_last = false;
+    std::vector<uint32_t> tf_buf;
+    PositionLists pos_buf;
 
     auto flush = [&]() {
         if (current_term.empty()) return;
-        postings.write(reinterpret_cast<char*>(postings_buf.data()),
-                       postings_buf.size() * sizeof(uint32_t));
-        lexicon.push_back({current_term, offset, (uint32_t)postings_buf.size()});
-        offset += postings_buf.size() * sizeof(uint32_t);
+        writer.add(current_term, postings_buf, positional ? &pos_buf : nullptr, &tf_buf);
         postings_buf.clear();
+        tf_buf.clear();
+        pos_buf.clear();
         current_term.clear();
     };
 
-    while (true) {
-        int best = -1;
-        for (size_t i = 0; i < runs.size(); ++i) {
-            if (!runs[i].valid) continue;
-            if (best < 0 ||
-                runs[i].term < runs[best].term ||
-                (runs[i].term == runs[best].term && runs[i].doc < runs[best].doc)) {
-                best = (int)i;
-            }
-        }
-        if (best < 0) break;
-
-        auto term = runs[best].term;
-        auto doc = runs[best].doc;
-        runs[best].next();
-
-        if (has_last && term == last_term && doc == last_doc) continue;
-        has_last = true;
-        last_term = term;
-        last_doc = doc;
-
-        if (current_term.empty()) {
-            current_term = term;
-            postings_buf.push_back(doc);
-        } else if (term == current_term) {
-            if (postings_buf.back() != doc) postings_buf.push_back(doc);
+    auto push = [&](const RunReader& r) {
+        postings_buf.push_back(r.doc);
+        tf_buf.push_back(r.tf);
+        if (!positional) return;
+        pos_buf.pos.insert(pos_buf.pos.end(), r.positions.begin(), r.positions.end());
+        pos_buf.ends.push_back((uint32_t)pos_buf.pos.size());
+    };
+
+    LoserTree<RunReader, decltype(&cmp_runs)> tree(runs, &cmp_runs);
+
+    for (int best; (best = tree.top()) >= 0; ) {
+        RunReader& r = runs[best];
+
+        if (!current_term.empty() && r.term == current_term) {
+            if (postings_buf.back() != r.doc) push(r);
+            else tf_buf.back() += r.tf;
         } else {
             flush();
-            current_term = term;
-            postings_buf.push_back(doc);
+            current_term = r.term;
+            push(r);
         }
+
+        r.next();
+        tree.replay();
     }
 
     flush();
 
-    std::ofstream terms(terms_path, std::ios::binary);
-    if (!terms) return false;
-
-    terms.write("BIDX", 4);
-    write_u32(terms, 1);
-    write_u32(terms, (uint32_t)lexicon.size());
-
-    for (const auto& e : lexicon) {
-        uint16_t len = static_cast<uint16_t>(std::min<size_t>(e.term.size(), 65535));
-        write_u16(terms, len);
-        if (len) terms.write(e.term.data(), len);
-        write_u64(terms, e.offset);
-        write_u32(terms, e.df);
-    }
-
-    return true;
+    return writer.finish(dir + "/terms.bin.tmp");
 }
 
-int main(int argc, char** argv) {
-    ProgramArgs a;
-    if (!parse_args(argc, argv, a)) return 1;
-
-    std::system(("mkdir -p \"" + a.out_dir + "\"").c_str());
-
-    std::vector<std::string> docs;
-    if (!read_lines(a.docs_list, docs)) return 2;
-    uint32_t doc_count = (uint32_t)docs.size();
-    if (!doc_count) return 3;
+// Each worker pulls doc ids from a shared counter and writes its own sorted runs.
+// The merge sorts and dedups (term, doc) pairs globally, so the final index does
+// not depend on how documents were distributed between workers.
+struct RunWorker {
+    int id = 0;
+    std::vector<std::string> run_paths;
+    bool ok = true;
+    TokenStats* stats = nullptr;
+    TermCounter* counter = nullptr;
+};
 
-    if (!build_docs_file(a.meta_tsv, doc_count, a.out_dir + "/docs.bin")) return 4;
+// With --token_stats and --termfreq the build is also the single pass over
+// the corpus for text_token_stats and term_frequency: every document a worker
+// tokenizes for the index is fed to that worker's stats and term counts too.
+struct CorpusOutputs {
+    std::vector<TokenStats> stats;
+    std::vector<TermCounter> counters;
+    double sec = 0;
+};
 
+static void index_docs(const ProgramArgs& a,
+                       const std::vector<std::string>& docs,
+                       uint32_t doc_base,
+                       uint32_t doc_end,
+                       const std::string& dir,
+                       std::atomic<uint32_t>& next_doc,
+                       uint64_t chunk_pairs,
+                       std::vector<uint32_t>& doc_lens,
+                       StemCache* stem_cache,
+                       RunWorker& w) {
     TokenizerConfig tc;
     tc.lowercase = true;
     tc.normalize_yo = true;
     Tokenizer tokenizer(tc);
     RussianStemmer stemmer;
+    auto stem = [&](std::string& t) {
+        if (stem_cache) stem_cache->stem(t);
+        else stemmer.stem(t);
+    };
 
-    std::vector<TermDoc> chunk;
-    chunk.reserve((size_t)a.chunk_pairs);
+    TermDict dict;
+    std::vector<uint32_t> last_doc;
+    std::vector<uint32_t> last_at;
+    std::vector<TermPair> pairs;
+    std::vector<uint32_t> tfs;
+    pairs.reserve((size_t)chunk_pairs);
+    PositionLists positions;
+    std::vector<std::pair<uint32_t, uint32_t>> doc_terms;
 
-    std::vector<std::string> run_paths;
     int run_id = 0;
+    auto flush_run = [&]() {
+        std::string path = dir + "/run_" + std::to_string(w.id) + "_" +
+                           std::to_string(run_id++) + ".bin";
+        if (!write_run(path, dict, pairs, a.positions ? &positions : nullptr,
+                       a.freqs ? &tfs : nullptr)) return false;
+        w.run_paths.push_back(path);
+        dict.clear();
+        last_doc.clear();
+        last_at.clear();
+        pairs.clear();
+        tfs.clear();
+        positions.clear();
+        return true;
+    };
 
-    for (uint32_t doc_id = 0; doc_id < doc_count; ++doc_id) {
-        std::string text;
-        if (!read_file_utf8(docs[doc_id], text)) continue;
+    std::string text;
+    std::vector<std::string> toks;
 
-        std::vector<std::string> toks;
-        tokenizer.tokenize(text, toks);
+    while (true) {
+        uint32_t global_id = next_doc.fetch_add(1);
+        if (global_id >= doc_end) break;
+        uint32_t doc_id = global_id - doc_base;
+
+        if (!read_file_utf8(docs[global_id], text)) continue;
 
+        tokenizer.tokenize(text, toks);
         if (a.use_stemming) {
-            for (auto& t : toks) t = stemmer.stem(t);
+            for (auto& t : toks) stem(t);
+        }
+        if (w.stats) w.stats->add_doc(text.size(), toks);
+        if (w.counter && !w.counter->add_doc(toks, global_id)) {
+            w.ok = false;
+            return;
         }
 
-        merge_sort_strings(toks);
-        toks.erase(std::unique(toks.begin(), toks.end()), toks.end());
+        // With positions a document's pairs never straddle two runs, so the
+        // merge does not need to combine position lists.
+        if (a.positions) {
+            doc_terms.clear();
+            for (uint32_t i = 0; i < toks.size(); ++i) {
+                if (toks[i].empty()) continue;
+                doc_terms.push_back({dict.intern(toks[i]), i});
+            }
+            std::sort(doc_terms.begin(), doc_terms.end());
+            doc_lens[doc_id] = (uint32_t)doc_terms.size();
+            for (size_t k = 0; k < doc_terms.size(); ++k) {
+                if (k == 0 || doc_terms[k].first != doc_terms[k - 1].first) {
+                    if (k) positions.ends.push_back((uint32_t)positions.pos.size());
+                    pairs.push_back({doc_terms[k].first, doc_id});
+                }
+                positions.pos.push_back(doc_terms[k].second);
+            }
+            if (!doc_terms.empty()) positions.ends.push_back((uint32_t)positions.pos.size());
+
+            if ((pairs.size() >= chunk_pairs || positions.pos.size() >= 0x80000000u) &&
+                !flush_run()) {
+                w.ok = false;
+                return;
+            }
+            continue;
+        }
 
+        // A document split between two runs yields partial tfs for the same
+        // (term, doc); merge_runs adds them up.
         for (const auto& t : toks) {
             if (t.empty()) continue;
-            chunk.push_back({t, doc_id});
-            if (chunk.size() >= a.chunk_pairs) {
-                std::string path = a.out_dir + "/run_" + std::to_string(run_id++) + ".bin";
-                if (!write_run(path, chunk)) return 5;
-                run_paths.push_back(path);
-                chunk.clear();
+            ++doc_lens[doc_id];
+
+            uint32_t id = dict.intern(t);
+            if (id == last_doc.size()) {
+                last_doc.push_back(doc_id);
+                last_at.push_back((uint32_t)pairs.size());
+            } else if (last_doc[id] == doc_id) {
+                if (a.freqs) ++tfs[last_at[id]];
+                continue;
+            } else {
+                last_doc[id] = doc_id;
+                last_at[id] = (uint32_t)pairs.size();
+            }
+
+            pairs.push_back({id, doc_id});
+            if (a.freqs) tfs.push_back(1);
+            if (pairs.size() >= chunk_pairs && !flush_run()) {
+                w.ok = false;
+                return;
             }
         }
     }
 
-    if (!chunk.empty()) {
-        std::string path = a.out_dir + "/run_" + std::to_string(run_id++) + ".bin";
-        if (!write_run(path, chunk)) return 6;
-        run_paths.push_back(path);
-        chunk.clear();
+    if (!pairs.empty() && !flush_run()) w.ok = false;
+}
+
+// Indexes docs[doc_base, doc_end) into dir with local doc ids starting at 0.
+// The files replace the ones in dir only once all of them are written (see
+// publish_segment_files).
+static int build_index(const ProgramArgs& a,
+                       const std::vector<std::string>& docs,
+                       uint32_t doc_base,
+                       uint32_t doc_end,
+                       const std::string& dir,
+                       CorpusOutputs* outputs) {
+    std::system(("mkdir -p \"" + dir + "\"").c_str());
+
+    uint32_t doc_count = doc_end - doc_base;
+    if (!build_docs_file(a.meta_tsv, doc_base, doc_count, dir + "/docs.bin.tmp")) return 4;
+
+    int threads = std::min<int>(a.threads, (int)doc_count);
+    uint64_t chunk_pairs = std::max<uint64_t>(1, a.chunk_pairs / (uint64_t)threads);
+
+    std::vector<uint32_t> doc_lens(doc_count, 0);
+    std::atomic<uint32_t> next_doc(doc_base);
+    std::unique_ptr<StemCache> stem_cache;
+    if (a.use_stemming && a.stem_cache) stem_cache.reset(new StemCache(a.stem_cache));
+    std::vector<RunWorker> workers(threads);
+    for (int t = 0; t < threads; ++t) {
+        workers[t].id = t;
+        if (!outputs) continue;
+        workers[t].stats = &outputs->stats[t];
+        if (!outputs->counters.empty()) workers[t].counter = &outputs->counters[t];
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    if (threads == 1) {
+        index_docs(a, docs, doc_base, doc_end, dir, next_doc, chunk_pairs, doc_lens, stem_cache.get(), workers[0]);
+    } else {
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t) {
+            pool.emplace_back(index_docs, std::cref(a), std::cref(docs), doc_base, doc_end,
+                              std::cref(dir), std::ref(next_doc), chunk_pairs,
+                              std::ref(doc_lens), stem_cache.get(), std::ref(workers[t]));
+        }
+        for (auto& th : pool) th.join();
+    }
+    if (outputs) outputs->sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (stem_cache) {
+        StemCacheStats st = stem_cache->stats();
+        std::cerr << "stem_cache_hits=" << st.hits << " stem_cache_misses=" << st.misses
+                  << " stem_cache_hit_rate=" << st.hit_rate() << "\n";
+    }
+
+    std::vector<std::string> run_paths;
+    for (const auto& w : workers) {
+        if (!w.ok) return 5;
+        run_paths.insert(run_paths.end(), w.run_paths.begin(), w.run_paths.end());
     }
 
-    if (!merge_runs(run_paths,
-                    a.out_dir + "/terms.bin",
-                    a.out_dir + "/postings.bin")) return 7;
+    if (!merge_runs(run_paths, dir, a.format, a.positions, a.bitmaps, a.freqs ? &doc_lens : nullptr)) return 7;
+    if (a.freqs && !save_doc_lens(dir + "/doclens.bin.tmp", doc_lens)) return 7;
 
     for (const auto& p : run_paths) std::remove(p.c_str());
 
+    return publish_segment_files(dir) ? 0 : 7;
+}
+
+static std::string next_segment_name(const std::vector<SegmentInfo>& segs) {
+    unsigned long seq = 0;
+    for (const auto& s : segs) {
+        if (!str_starts_with(s.name, "seg_")) continue;
+        try { seq = std::max(seq, std::stoul(s.name.substr(4))); }
+        catch (...) {}
+    }
+    std::string num = std::to_string(seq + 1);
+    return "seg_" + std::string(num.size() < 6 ? 6 - num.size() : 0, '0') + num;
+}
+
+static void remove_segment(const std::string& dir, const SegmentInfo& s) {
+    if (s.name == ".") {
+        std::remove((dir + "/terms.bin").c_str());
+        std::remove((dir + "/postings.bin").c_str());
+        std::remove((dir + "/positions.bin").c_str());
+        std::remove((dir + "/freqs.bin").c_str());
+        std::remove((dir + "/bitmaps.bin").c_str());
+        std::remove((dir + "/docs.bin").c_str());
+        std::remove((dir + "/doclens.bin").c_str());
+        std::remove((dir + "/deleted.bin").c_str());
+    } else {
+        std::system(("rm -rf \"" + segment_dir(dir, s) + "\"").c_str());
+    }
+}
+
+// A directory holds either a plain or segmented index (segments.txt, seg_*)
+// or a sharded one (shards.txt, shard_*); a build of one kind removes the
+// other's files once it has succeeded.
+static void remove_unsharded(const std::string& dir) {
+    std::vector<SegmentInfo> segs;
+    if (load_manifest(dir, segs)) {
+        for (const auto& s : segs) {
+            if (s.name != ".") remove_segment(dir, s);
+        }
+    }
+    remove_segment(dir, {".", 0, 0});
+    std::remove((dir + "/segments.txt").c_str());
+}
+
+static void remove_shards(const std::string& dir) {
+    std::vector<SegmentInfo> shards;
+    if (!load_manifest(dir, shards, "shards.txt")) return;
+    for (const auto& s : shards) remove_segment(dir, s);
+    std::remove((dir + "/shards.txt").c_str());
+}
+
+struct SegmentSource {
+    std::vector<LexEntry> lex;
+    uint32_t version = 0;
+    uint32_t flags = 0;
+    std::ifstream postings;
+    std::ifstream positions;
+    std::ifstream freqs;
+    std::vector<uint8_t> deleted;
+    std::vector<uint32_t> doc_lens;
+    uint32_t shift = 0;
+    size_t pos = 0;
+    bool valid = false;
+
+    const std::string& term() const { return lex[pos].term; }
+    void next() { valid = ++pos < lex.size(); }
+};
+
+static int cmp_sources(const SegmentSource& a, const SegmentSource& b) {
+    return a.term().compare(b.term());
+}
+
+static bool copy_docs(const std::vector<std::string>& dirs, uint32_t doc_count,
+                      const std::string& out_path) {
+    std::vector<std::string> urls, titles;
+    urls.reserve(doc_count);
+    titles.reserve(doc_count);
+
+    std::vector<std::string> u, t;
+    for (const auto& d : dirs) {
+        if (!load_docs(d + "/docs.bin", u, t)) return false;
+        for (size_t i = 0; i < u.size(); ++i) {
+            urls.push_back(std::move(u[i]));
+            titles.push_back(std::move(t[i]));
+        }
+    }
+    return urls.size() == doc_count && save_docs(out_path, urls, titles);
+}
+
+// Merges the contiguous segments segs[from, to) into one new segment.
+static int merge_segment_range(const ProgramArgs& a,
+                               const std::vector<SegmentInfo>& segs,
+                               size_t from, size_t to,
+                               SegmentInfo& merged) {
+    merged.name = next_segment_name(segs);
+    merged.doc_base = segs[from].doc_base;
+    merged.doc_count = 0;
+
+    std::vector<SegmentSource> src(to - from);
+    std::vector<std::string> dirs;
+    bool any_deleted = false;
+    for (size_t i = from; i < to; ++i) {
+        SegmentSource& s = src[i - from];
+        std::string d = segment_dir(a.out_dir, segs[i]);
+        if (!load_terms(d + "/terms.bin", s.lex, s.version, s.flags)) return 2;
+        s.postings.open(d + "/postings.bin", std::ios::binary);
+        if (!s.postings) return 3;
+        if (s.flags & kBidxFlagPositions) {
+            s.positions.open(d + "/positions.bin", std::ios::binary);
+            if (!s.positions) return 3;
+        }
+        if (s.flags & kBidxFlagFreqs) {
+            s.freqs.open(d + "/freqs.bin", std::ios::binary);
+            if (!s.freqs || !load_doc_lens(d, s.doc_lens)) return 3;
+        }
+        any_deleted |= load_deleted(d, s.deleted);
+        s.shift = segs[i].doc_base - merged.doc_base;
+        s.valid = !s.lex.empty();
+        dirs.push_back(d);
+        merged.doc_count += segs[i].doc_count;
+    }
+
+    std::string out = segment_dir(a.out_dir, merged);
+    std::system(("mkdir -p \"" + out + "\"").c_str());
+
+    if (!copy_docs(dirs, merged.doc_count, out + "/docs.bin.tmp")) return 4;
+
+    // Deleted docs keep their ids (they still occupy docs.bin slots) but are
+    // dropped from the merged postings; the bitmap is carried over for NOT.
+    if (any_deleted) {
+        std::vector<uint8_t> bits((merged.doc_count + 7) / 8, 0);
+        for (size_t i = from; i < to; ++i) {
+            const SegmentSource& s = src[i - from];
+            for (uint32_t d = 0; d < segs[i].doc_count; ++d) {
+                if (!is_deleted(s.deleted, d)) continue;
+                uint32_t g = d + s.shift;
+                bits[g >> 3] |= (uint8_t)(1u << (g & 7));
+            }
+        }
+        if (!save_deleted(out, merged.doc_count, bits)) return 4;
+    }
+
+    bool positional = true;
+    bool freqs = true;
+    bool bitmaps = true;
+    for (const auto& s : src) {
+        positional &= (s.flags & kBidxFlagPositions) != 0;
+        freqs &= (s.flags & kBidxFlagFreqs) != 0;
+        bitmaps &= (s.flags & kBidxFlagBitmaps) != 0;
+    }
+
+    std::vector<uint32_t> doc_lens;
+    if (freqs) {
+        for (const auto& s : src) doc_lens.insert(doc_lens.end(), s.doc_lens.begin(), s.doc_lens.end());
+        if (doc_lens.size() != merged.doc_count || !save_doc_lens(out + "/doclens.bin.tmp", doc_lens)) return 4;
+    }
+
+    uint32_t format = a.format_given ? a.format : src.back().version;
+    IndexWriter writer;
+    if (!writer.open(out + "/postings.bin.tmp", format)) return 7;
+    if (positional && !writer.open_positions(out + "/positions.bin.tmp")) return 7;
+    if (freqs && !writer.open_freqs(out + "/freqs.bin.tmp", doc_lens)) return 7;
+    if (bitmaps && !writer.open_bitmaps(out + "/bitmaps.bin.tmp")) return 7;
+
+    LoserTree<SegmentSource, decltype(&cmp_sources)> tree(src, &cmp_sources);
+
+    std::string current_term;
+    std::vector<uint32_t> docs, tfs;
+    std::vector<uint32_t> part, part_tfs;
+    PositionLists pos, part_pos;
+
+    for (int best; (best = tree.top()) >= 0; ) {
+        SegmentSource& s = src[best];
+        if (s.term() != current_term) {
+            if (!docs.empty()) writer.add(current_term, docs, &pos, &tfs);
+            docs.clear();
+            tfs.clear();
+            pos.clear();
+            current_term = s.term();
+        }
+        read_postings(s.postings, s.version, s.flags, s.lex[s.pos], part);
+        if (positional && !read_positions(s.positions, s.lex[s.pos], part_pos)) return 3;
+        if (freqs && !read_freqs(s.freqs, s.lex[s.pos], part_tfs)) return 3;
+        for (size_t i = 0; i < part.size(); ++i) {
+            if (is_deleted(s.deleted, part[i])) continue;
+            docs.push_back(part[i] + s.shift);
+            if (freqs) tfs.push_back(part_tfs[i]);
+            if (!positional) continue;
+            uint32_t begin = i ? part_pos.ends[i - 1] : 0;
+            pos.pos.insert(pos.pos.end(), part_pos.pos.begin() + begin,
+                           part_pos.pos.begin() + part_pos.ends[i]);
+            pos.ends.push_back((uint32_t)pos.pos.size());
+        }
+
+        s.next();
+        tree.replay();
+    }
+    if (!docs.empty()) writer.add(current_term, docs, &pos, &tfs);
+
+    if (!writer.finish(out + "/terms.bin.tmp") || !publish_segment_files(out)) return 7;
+    return 0;
+}
+
+static int tier_of(uint32_t doc_count, int factor) {
+    int tier = 0;
+    for (uint64_t c = doc_count; c >= (uint64_t)factor; c /= factor) ++tier;
+    return tier;
+}
+
+// Size-tiered policy: merge the first run of at least merge_factor adjacent
+// segments that fall into the same log_factor(doc_count) tier, and repeat
+// until no tier is full. Only adjacent segments are merged so every segment
+// keeps a contiguous doc id range.
+static int merge_segments(const ProgramArgs& a) {
+    std::vector<SegmentInfo> segs;
+    if (!list_segments(a.out_dir, segs)) return 2;
+
+    while (true) {
+        size_t from = 0, to = 0;
+        for (size_t i = 0; i < segs.size() && to == 0; ) {
+            size_t j = i + 1;
+            int tier = tier_of(segs[i].doc_count, a.merge_factor);
+            while (j < segs.size() && tier_of(segs[j].doc_count, a.merge_factor) == tier) ++j;
+            if (j - i >= (size_t)a.merge_factor) { from = i; to = j; }
+            i = j;
+        }
+        if (to == 0) break;
+
+        SegmentInfo merged;
+        int rc = merge_segment_range(a, segs, from, to, merged);
+        if (rc) return rc;
+
+        std::vector<SegmentInfo> old(segs.begin() + from, segs.begin() + to);
+        segs.erase(segs.begin() + from, segs.begin() + to);
+        segs.insert(segs.begin() + from, merged);
+        if (!save_manifest(a.out_dir, segs)) return 8;
+
+        for (const auto& s : old) remove_segment(a.out_dir, s);
+    }
+    return 0;
+}
+
+// Marks documents as deleted by global doc id or by URL from docs.bin. The
+// postings are left alone; search filters through the per-segment bitmap.
+// Every id and URL is resolved before anything is marked, so an unknown one
+// leaves the index untouched.
+static int delete_docs(const ProgramArgs& a) {
+    std::vector<SegmentInfo> segs;
+    if (!list_segments(a.out_dir, segs)) return 2;
+
+    std::vector<std::pair<size_t, uint32_t>> marks;
+    for (uint32_t id : a.delete_ids) {
+        bool found = false;
+        for (size_t k = 0; k < segs.size(); ++k) {
+            if (id < segs[k].doc_base || id - segs[k].doc_base >= segs[k].doc_count) continue;
+            marks.push_back({k, id - segs[k].doc_base});
+            found = true;
+        }
+        if (!found) return 10;
+    }
+
+    if (!a.delete_urls.empty()) {
+        std::vector<bool> matched(a.delete_urls.size(), false);
+        std::vector<std::string> urls, titles;
+        for (size_t k = 0; k < segs.size(); ++k) {
+            if (!load_docs(segment_dir(a.out_dir, segs[k]) + "/docs.bin", urls, titles)) return 3;
+            for (uint32_t i = 0; i < urls.size(); ++i) {
+                for (size_t u = 0; u < a.delete_urls.size(); ++u) {
+                    if (urls[i] != a.delete_urls[u]) continue;
+                    marks.push_back({k, i});
+                    matched[u] = true;
+                    break;
+                }
+            }
+        }
+        for (bool m : matched) {
+            if (!m) return 10;
+        }
+    }
+
+    for (const auto& m : marks) {
+        if (!mark_deleted(segment_dir(a.out_dir, segs[m.first]), segs[m.first].doc_count, m.second)) return 9;
+    }
+    std::cout << "deleted=" << marks.size() << "\n";
+    return 0;
+}
+
+// Splits the documents into contiguous ranges, each a self-contained index in
+// <out>/shard_NNN whose manifest places it at its global doc id offset, and
+// lists the shards in <out>/shards.txt in the manifest's format.
+static int build_shards(const ProgramArgs& a, const std::vector<std::string>& docs, CorpusOutputs* outputs) {
+    uint32_t doc_count = (uint32_t)docs.size();
+    uint32_t n = std::min(a.shards, doc_count);
+    std::vector<SegmentInfo> old, shards;
+    load_manifest(a.out_dir, old, "shards.txt");
+    for (uint32_t s = 0; s < n; ++s) {
+        uint32_t begin = (uint32_t)((uint64_t)doc_count * s / n);
+        uint32_t end = (uint32_t)((uint64_t)doc_count * (s + 1) / n);
+        std::string num = std::to_string(s);
+        SegmentInfo shard{"shard_" + std::string(num.size() < 3 ? 3 - num.size() : 0, '0') + num, begin, end - begin};
+        std::string dir = a.out_dir + "/" + shard.name;
+        std::system(("rm -rf \"" + dir + "\"").c_str());
+        int rc = build_index(a, docs, begin, end, dir, outputs);
+        if (rc) return rc;
+        if (!save_manifest(dir, {{".", begin, end - begin}})) return 8;
+        shards.push_back(shard);
+    }
+
+    if (!save_manifest(a.out_dir, shards, "shards.txt")) return 8;
+    for (size_t s = n; s < old.size(); ++s) remove_segment(a.out_dir, old[s]);
+    remove_unsharded(a.out_dir);
+    return 0;
+}
+
+static int write_outputs(const ProgramArgs& a, const CorpusOutputs& outputs, size_t docs) {
+    if (!a.token_stats.empty()) {
+        TokenStats st;
+        for (const auto& s : outputs.stats) st.add(s);
+        std::ofstream out(a.token_stats);
+        if (!out) return 11;
+        write_token_stats(out, st, docs, outputs.sec, a.use_stemming);
+        if (!out) return 11;
+    }
+    if (!a.termfreq.empty() && !TermCounter::merge(outputs.counters, a.termfreq)) return 11;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    ProgramArgs a;
+    if (!parse_args(argc, argv, a)) return 1;
+
+    if (a.merge) return merge_segments(a);
+    if (a.remove_docs) return delete_docs(a);
+
+    std::vector<std::string> docs;
+    if (!read_lines(a.docs_list, docs)) return 2;
+    uint32_t doc_count = (uint32_t)docs.size();
+    if (!doc_count) return 3;
+
+    std::unique_ptr<CorpusOutputs> outputs;
+    if (!a.token_stats.empty() || !a.termfreq.empty()) {
+        if (a.append) return 1;
+        outputs.reset(new CorpusOutputs);
+        outputs->stats.resize(a.threads);
+        size_t counter_bytes = std::max<size_t>(1, (a.tf_mem_mb << 20) / (size_t)a.threads);
+        for (int t = 0; !a.termfreq.empty() && t < a.threads; ++t) {
+            outputs->counters.emplace_back(a.out_dir + "/counts_" + std::to_string(t) + "_", counter_bytes);
+        }
+    }
+    if (a.shards > 1) {
+        if (a.append) return 1;
+        int rc = build_shards(a, docs, outputs.get());
+        return rc || !outputs ? rc : write_outputs(a, *outputs, docs.size());
+    }
+
+    std::vector<SegmentInfo> segs;
+    bool has_manifest = load_manifest(a.out_dir, segs);
+
+    if (!a.append) {
+        int rc = build_index(a, docs, 0, doc_count, a.out_dir, outputs.get());
+        if (rc) return rc;
+        std::remove((a.out_dir + "/deleted.bin").c_str());
+        if (has_manifest) {
+            for (const auto& s : segs) {
+                if (s.name != ".") remove_segment(a.out_dir, s);
+            }
+            std::remove((a.out_dir + "/segments.txt").c_str());
+        }
+        remove_shards(a.out_dir);
+        return outputs ? write_outputs(a, *outputs, docs.size()) : 0;
+    }
+
+    uint32_t n;
+    if (!has_manifest && read_docs_count(a.out_dir + "/docs.bin", n)) {
+        segs.push_back({".", 0, n});
+    }
+
+    uint32_t base = segs.empty() ? 0 : segs.back().doc_base + segs.back().doc_count;
+    if (base >= doc_count) return 0;
+
+    SegmentInfo seg{next_segment_name(segs), base, doc_count - base};
+    uint32_t flags = 0;
+    if (!a.format_given && !segs.empty() &&
+        read_terms_header(segment_dir(a.out_dir, segs.back()) + "/terms.bin", a.format, flags)) {
+        a.positions |= (flags & kBidxFlagPositions) != 0;
+        a.freqs |= (flags & kBidxFlagFreqs) != 0;
+        a.bitmaps |= (flags & kBidxFlagBitmaps) != 0;
+    }
+    int rc = build_index(a, docs, base, doc_count, segment_dir(a.out_dir, seg), nullptr);
+    if (rc) return rc;
+
+    segs.push_back(seg);
+    if (!save_manifest(a.out_dir, segs)) return 8;
+    remove_shards(a.out_dir);
     return 0;
 }
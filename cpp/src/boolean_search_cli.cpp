@@ -1,140 +1,34 @@
 #include "text_tokenizer.h"
 #include "word_stemmer.h"
 #include "fs_utils.h"
+#include "doc_set.h"
+#include "index_io.h"
+#include "query_cache.h"
+#include "ranking.h"
+#include "search_server.h"
+#include "set_ops.h"
+#include "work_pool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <vector>
 
-struct LexEntry {
-    std::string term;
-    uint64_t offset;
-    uint32_t df;
-};
-
-static uint16_t read_u16(std::ifstream& in) { uint16_t x; in.read(reinterpret_cast<char*>(&x), sizeof(x)); return x; }
-static uint32_t read_u32(std::ifstream& in) { uint32_t x; in.read(reinterpret_cast<char*>(&x), sizeof(x)); return x; }
-static uint64_t read_u64(std::ifstream& in) { uint64_t x; in.read(reinterpret_cast<char*>(&x), sizeof(x)); return x; }
-
-static bool load_terms(const std::string& path, std::vector<LexEntry>& lex) {
-    std::ifstream in(path, std::ios::binary);
-    if (!in) return false;
-
-    char magic[4];
-    in.read(magic, 4);
-    if (std::string(magic, 4) != "BIDX") return false;
-
-    uint32_t ver = read_u32(in);
-    if (ver != 1) return false;
-
-    uint32_t n = read_u32(in);
-    lex.clear();
-    lex.reserve(n);
-
-    for (uint32_t i = 0; i < n; ++i) {
-        uint16_t len = read_u16(in);
-        std::string term(len, '\0');
-        if (len) in.read(&term[0], len);
-        uint64_t off = read_u64(in);
-        uint32_t df = read_u32(in);
-        lex.push_back({term, off, df});
-    }
-    return true;
-}
-
-static bool load_docs(const std::string& path,
-                      std::vector<std::string>& urls,
-                      std::vector<std::string>& titles) {
-    std::ifstream in(path, std::ios::binary);
-    if (!in) return false;
-
-    char magic[4];
-    in.read(magic, 4);
-    if (std::string(magic, 4) != "DOCS") return false;
-
-    uint32_t ver = read_u32(in);
-    if (ver != 1) return false;
-
-    uint32_t n = read_u32(in);
-    urls.resize(n);
-    titles.resize(n);
-
-    for (uint32_t i = 0; i < n; ++i) {
-        uint16_t ulen = read_u16(in);
-        std::string url(ulen, '\0');
-        if (ulen) in.read(&url[0], ulen);
-
-        uint16_t tlen = read_u16(in);
-        std::string title(tlen, '\0');
-        if (tlen) in.read(&title[0], tlen);
-
-        urls[i] = url;
-        titles[i] = title;
-    }
-    return true;
-}
-
-static int lex_find(const std::vector<LexEntry>& lex, const std::string& term) {
-    int l = 0;
-    int r = (int)lex.size() - 1;
-    while (l <= r) {
-        int m = l + (r - l) / 2;
-        if (lex[m].term == term) return m;
-        if (lex[m].term < term) l = m + 1;
-        else r = m - 1;
-    }
-    return -1;
-}
-
-static void read_postings(std::ifstream& in, const LexEntry& e, std::vector<uint32_t>& out) {
-    out.resize(e.df);
-    in.seekg((std::streamoff)e.offset);
-    if (e.df) in.read(reinterpret_cast<char*>(out.data()),
-                      e.df * sizeof(uint32_t));
-}
-
-static void intersect(const std::vector<uint32_t>& a,
-                      const std::vector<uint32_t>& b,
-                      std::vector<uint32_t>& out) {
-    out.clear();
-    size_t i = 0, j = 0;
-    while (i < a.size() && j < b.size()) {
-        if (a[i] == b[j]) { out.push_back(a[i]); ++i; ++j; }
-        else if (a[i] < b[j]) ++i;
-        else ++j;
-    }
-}
-
-static void unite(const std::vector<uint32_t>& a,
-                  const std::vector<uint32_t>& b,
-                  std::vector<uint32_t>& out) {
-    out.clear();
-    size_t i = 0, j = 0;
-    while (i < a.size() && j < b.size()) {
-        if (a[i] == b[j]) { out.push_back(a[i]); ++i; ++j; }
-        else if (a[i] < b[j]) out.push_back(a[i++]);
-        else out.push_back(b[j++]);
-    }
-    while (i < a.size()) out.push_back(a[i++]);
-    while (j < b.size()) out.push_back(b[j++]);
-}
-
-static void diff(const std::vector<uint32_t>& a,
-                 const std::vector<uint32_t>& b,
-                 std::vector<uint32_t>& out) {
-    out.clear();
-    size_t i = 0, j = 0;
-    while (i < a.size()) {
-        if (j >= b.size()) out.push_back(a[i++]);
-        else if (a[i] == b[j]) { ++i; ++j; }
-        else if (a[i] < b[j]) out.push_back(a[i++]);
-        else ++j;
-    }
-}
+#include <sys/stat.h>
 
 static void complement(uint32_t doc_count,
+                       const std::vector<uint8_t>& deleted,
                        const std::vector<uint32_t>& a,
                        std::vector<uint32_t>& out) {
     out.clear();
@@ -142,17 +36,30 @@ static void complement(uint32_t doc_count,
     for (uint32_t d = 0; d < doc_count; ++d) {
         while (j < a.size() && a[j] < d) ++j;
         if (j < a.size() && a[j] == d) continue;
+        if (is_deleted(deleted, d)) continue;
         out.push_back(d);
     }
 }
 
-enum TokenType { TT_TERM, TT_AND, TT_OR, TT_NOT, TT_LP, TT_RP };
+enum TokenType { TT_TERM, TT_AND, TT_OR, TT_NOT, TT_LP, TT_RP, TT_PHRASE, TT_NEAR, TT_PREFIX };
 
+// TT_PREFIX: "abc*", unstemmed prefix in term. TT_PHRASE: "a b c", terms in phrase. TT_NEAR: "x NEAR/k y" where either side
+// may be a phrase; left side in phrase, right side in right, k in slop.
 struct QueryToken {
     TokenType type;
     std::string term;
+    std::vector<std::string> phrase;
+    std::vector<std::string> right;
+    int slop = 0;
+
+    QueryToken(TokenType t, std::string s) : type(t), term(std::move(s)) {}
 };
 
+static bool is_operand(const QueryToken& t) {
+    return t.type == TT_TERM || t.type == TT_PHRASE || t.type == TT_PREFIX ||
+           (t.type == TT_NEAR && !t.phrase.empty());
+}
+
 static int precedence(TokenType t) {
     if (t == TT_NOT) return 3;
     if (t == TT_AND) return 2;
@@ -169,25 +76,60 @@ static void tokenize_query(const std::string& q,
                            bool stemming) {
     out.clear();
     std::string buf;
+    bool quoted = false;
+
+    auto terms_of = [&](const std::string& text, bool stem) {
+        std::vector<std::string> ts;
+        tokenizer.tokenize(text, ts);
+        std::vector<std::string> terms;
+        for (auto& t : ts) {
+            if (stem) stemmer.stem(t);
+            if (!t.empty()) terms.push_back(t);
+        }
+        return terms;
+    };
 
     auto flush = [&]() {
         if (buf.empty()) return;
-        std::vector<std::string> ts;
-        tokenizer.tokenize(buf, ts);
-        bool first = true;
-        for (auto& raw : ts) {
-            std::string t = raw;
-            if (stemming) t = stemmer.stem(t);
-            if (t.empty()) continue;
-            if (!first) out.push_back({TT_AND, ""});
-            out.push_back({TT_TERM, t});
-            first = false;
+        if (str_starts_with(buf, "NEAR/") && buf.size() > 5 &&
+            buf.find_first_not_of("0123456789", 5) == std::string::npos) {
+            QueryToken t{TT_NEAR, ""};
+            t.slop = std::stoi(buf.substr(5));
+            out.push_back(t);
+            buf.clear();
+            return;
+        }
+        // The prefix is matched against stored terms as typed: stemming a
+        // word fragment would not give a prefix of the stems it should match.
+        bool prefix = buf.size() > 1 && buf.back() == '*';
+        if (prefix) buf.pop_back();
+        std::vector<std::string> terms = terms_of(buf, stemming && !prefix);
+        for (size_t i = 0; i < terms.size(); ++i) {
+            if (i) out.push_back({TT_AND, ""});
+            bool last = (i + 1 == terms.size());
+            out.push_back({prefix && last ? TT_PREFIX : TT_TERM, terms[i]});
         }
         buf.clear();
     };
 
+    auto flush_phrase = [&]() {
+        std::vector<std::string> terms = terms_of(buf, stemming);
+        buf.clear();
+        if (terms.size() == 1) out.push_back({TT_TERM, terms[0]});
+        else if (!terms.empty()) {
+            QueryToken t{TT_PHRASE, ""};
+            t.phrase = terms;
+            out.push_back(t);
+        }
+    };
+
     for (char c : q) {
-        if (c == '(') { flush(); out.push_back({TT_LP, ""}); }
+        if (quoted) {
+            if (c == '"') { flush_phrase(); quoted = false; }
+            else buf.push_back(c);
+        }
+        else if (c == '"') { flush(); quoted = true; }
+        else if (c == '(') { flush(); out.push_back({TT_LP, ""}); }
         else if (c == ')') { flush(); out.push_back({TT_RP, ""}); }
         else if (c == '&') { flush(); out.push_back({TT_AND, ""}); }
         else if (c == '|') { flush(); out.push_back({TT_OR, ""}); }
@@ -195,7 +137,47 @@ static void tokenize_query(const std::string& q,
         else if (isspace((unsigned char)c)) flush();
         else buf.push_back(c);
     }
-    flush();
+    if (quoted) flush_phrase();
+    else flush();
+}
+
+// Folds "x NEAR/k y" (x, y single terms or phrases) into one TT_NEAR operand.
+static bool fold_near(std::vector<QueryToken>& toks) {
+    std::vector<QueryToken> out;
+    for (size_t i = 0; i < toks.size(); ++i) {
+        if (toks[i].type != TT_NEAR) {
+            out.push_back(toks[i]);
+            continue;
+        }
+        if (out.empty() || i + 1 >= toks.size()) return false;
+        const QueryToken& l = out.back();
+        const QueryToken& r = toks[i + 1];
+        if ((l.type != TT_TERM && l.type != TT_PHRASE) ||
+            (r.type != TT_TERM && r.type != TT_PHRASE)) return false;
+
+        QueryToken t{TT_NEAR, ""};
+        t.slop = toks[i].slop;
+        t.phrase = (l.type == TT_TERM) ? std::vector<std::string>{l.term} : l.phrase;
+        t.right = (r.type == TT_TERM) ? std::vector<std::string>{r.term} : r.phrase;
+        out.back() = t;
+        ++i;
+    }
+    toks.swap(out);
+    return true;
+}
+
+// Ranked queries are free text: adjacent operands without an operator
+// between them are OR-ed.
+static void add_implicit_or(std::vector<QueryToken>& toks) {
+    std::vector<QueryToken> out;
+    for (const auto& t : toks) {
+        bool starts = is_operand(t) || t.type == TT_NOT || t.type == TT_LP;
+        if (starts && !out.empty() && (is_operand(out.back()) || out.back().type == TT_RP)) {
+            out.push_back({TT_OR, ""});
+        }
+        out.push_back(t);
+    }
+    toks.swap(out);
 }
 
 static bool to_postfix(const std::vector<QueryToken>& in,
@@ -204,7 +186,7 @@ static bool to_postfix(const std::vector<QueryToken>& in,
     std::vector<QueryToken> ops;
 
     for (const auto& t : in) {
-        if (t.type == TT_TERM) {
+        if (is_operand(t)) {
             out.push_back(t);
         } else if (t.type == TT_LP) {
             ops.push_back(t);
@@ -239,89 +221,1372 @@ static bool to_postfix(const std::vector<QueryToken>& in,
     return true;
 }
 
-static bool eval_postfix(const std::vector<QueryToken>& pf,
-                         uint32_t doc_count,
-                         const std::vector<LexEntry>& lex,
-                         std::ifstream& postings,
-                         std::vector<uint32_t>& out) {
-    std::vector<std::vector<uint32_t>> st;
+struct Segment {
+    SegmentInfo info;
+    std::string cache_prefix;
+    uint32_t version = 0;
+    uint32_t flags = 0;
+    Lexicon lex;
+    DocStore docs;
+    std::vector<uint8_t> deleted;
+    MappedFile doc_lens_file;
+    const uint32_t* doc_lens = nullptr;
+    uint32_t doc_lens_count = 0;
+    MappedFile postings;
+    MappedFile positions;
+    MappedFile freqs;
+    MappedFile bitmaps;
+};
+
+// Start positions of every occurrence of the phrase, given the positions of
+// each of its terms in one document.
+static void phrase_starts(const std::vector<int>& slots,
+                          const std::vector<std::vector<uint32_t>>& pos,
+                          std::vector<uint32_t>& out) {
+    out.clear();
+    for (uint32_t p : pos[slots[0]]) {
+        bool ok = true;
+        for (size_t i = 1; i < slots.size() && ok; ++i) {
+            const auto& v = pos[slots[i]];
+            ok = std::binary_search(v.begin(), v.end(), p + (uint32_t)i);
+        }
+        if (ok) out.push_back(p);
+    }
+}
+
+static bool within(const std::vector<uint32_t>& a, uint32_t len_a,
+                   const std::vector<uint32_t>& b, uint32_t len_b, uint32_t k) {
+    for (uint32_t s : a) {
+        uint64_t lo = (uint64_t)s + len_a;
+        auto it = std::lower_bound(b.begin(), b.end(), (uint32_t)std::min<uint64_t>(lo, UINT32_MAX));
+        if (it != b.end() && *it - (lo - 1) <= k) return true;
+        if (s < len_b) continue;
+        uint64_t hi = (uint64_t)s - len_b;
+        auto jt = std::upper_bound(b.begin(), b.end(), (uint32_t)hi);
+        if (jt != b.begin() && s - (*(jt - 1) + len_b - 1) <= k) return true;
+    }
+    return false;
+}
+
+// Phrase and NEAR/k: walk the rarest term's postings, probe the others
+// through their skip entries, and decode positions only for documents that
+// contain every term.
+static bool eval_positional(const QueryToken& t, const Segment& seg, std::vector<uint32_t>& out) {
+    out.clear();
+    if (!(seg.flags & kBidxFlagPositions)) return false;
+
+    std::vector<std::string> terms;
+    auto slots_of = [&](const std::vector<std::string>& group) {
+        std::vector<int> slots;
+        for (const auto& term : group) {
+            auto it = std::find(terms.begin(), terms.end(), term);
+            slots.push_back((int)(it - terms.begin()));
+            if (it == terms.end()) terms.push_back(term);
+        }
+        return slots;
+    };
+    std::vector<int> left = slots_of(t.phrase);
+    std::vector<int> right = slots_of(t.right);
 
+    size_t n = terms.size();
+    size_t lead = 0;
+    std::vector<LexEntry> entries(n);
+    std::vector<PostingCursor> lists(n);
+    std::vector<PositionCursor> cursors(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (!seg.lex.find(terms[i], entries[i])) return true;
+        if (!lists[i].open(seg.postings, seg.version, seg.flags, entries[i])) return false;
+        if (!cursors[i].open(seg.positions, entries[i])) return false;
+        if (entries[i].df < entries[lead].df) lead = i;
+    }
+
+    std::vector<std::vector<uint32_t>> pos(n);
+    std::vector<uint32_t> ls, rs;
+    for (; !lists[lead].done(); lists[lead].next()) {
+        uint32_t d = lists[lead].doc();
+        bool all = true;
+        for (size_t i = 0; i < n && all; ++i) {
+            lists[i].seek(d);
+            if (lists[i].done()) return lists[i].ok();
+            all = lists[i].doc() == d;
+        }
+        if (!all) continue;
+        for (size_t i = 0; i < n; ++i) {
+            if (!cursors[i].get(lists[i].index(), pos[i])) return false;
+        }
+        phrase_starts(left, pos, ls);
+        if (ls.empty()) continue;
+        if (t.type == TT_PHRASE) { out.push_back(d); continue; }
+        phrase_starts(right, pos, rs);
+        if (within(ls, (uint32_t)left.size(), rs, (uint32_t)right.size(), (uint32_t)t.slop)) {
+            out.push_back(d);
+        }
+    }
+    return lists[lead].ok();
+}
+
+// Probes every doc id of a short list against a long one through its skip
+// entries, so only the blocks that can hold a match are read and decoded.
+static bool intersect_probe(const std::vector<uint32_t>& a, PostingCursor& c,
+                            std::vector<uint32_t>& out) {
+    out.clear();
+    for (uint32_t d : a) {
+        c.seek(d);
+        if (c.done()) break;
+        if (c.doc() == d) out.push_back(d);
+    }
+    return c.ok();
+}
+
+// Doc ids of a that are not in the list behind c, probed the same way.
+static bool diff_probe(const std::vector<uint32_t>& a, PostingCursor& c,
+                       std::vector<uint32_t>& out) {
+    out.clear();
+    for (uint32_t d : a) {
+        c.seek(d);
+        if (c.done() || c.doc() != d) out.push_back(d);
+    }
+    return c.ok();
+}
+
+// starts[i] is the first postfix position of the subexpression ending at i.
+static bool subtree_starts(const std::vector<QueryToken>& pf, std::vector<size_t>& starts) {
+    starts.assign(pf.size(), 0);
+    std::vector<size_t> st;
+    for (size_t i = 0; i < pf.size(); ++i) {
+        if (is_operand(pf[i])) {
+            starts[i] = i;
+            st.push_back(i);
+        } else if (pf[i].type == TT_NOT) {
+            if (st.empty()) return false;
+            starts[i] = starts[st.back()];
+            st.back() = i;
+        } else {
+            if (st.size() < 2) return false;
+            st.pop_back();
+            starts[i] = starts[st.back()];
+            st.back() = i;
+        }
+    }
+    return st.size() == 1;
+}
+
+struct PlanNode;
+
+// A term operand stays unread (lazy) until an operation needs its doc ids;
+// AND with a shorter operand probes it instead of reading it whole. Results
+// taken from or stored in the cache are shared instead of copied.
+struct Operand {
+    std::vector<uint32_t> docs;
+    DocList shared;
+    bool lazy = false;
+    LexEntry entry;
+    const PlanNode* node = nullptr;
+    // Set instead of docs when the operand came from a bitmaps.bin record.
+    DocSet set;
+    bool dense = false;
+
+    const std::vector<uint32_t>& ids() const { return shared ? *shared : docs; }
+    bool empty() const { return dense ? set.empty() : ids().empty(); }
+};
+
+// Union of the posting lists of every term that starts with the prefix.
+static bool eval_prefix(const QueryToken& t, const Segment& seg, std::vector<uint32_t>& out) {
+    std::vector<LexEntry> entries;
+    if (!seg.lex.find_prefix(t.term, entries)) return false;
+    out.clear();
+    std::vector<uint32_t> v;
+    for (const auto& e : entries) {
+        read_postings(seg.postings, seg.version, seg.flags, e, v);
+        out.insert(out.end(), v.begin(), v.end());
+    }
+    if (entries.size() > 1) {
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+    return true;
+}
+
+// Query plan: AND and OR are n-ary, "!!x" is x, and an AND of only negated
+// operands becomes the negation of their OR. est is an upper bound on the
+// result size from the lexicon's df. key is the canonical text used by the
+// cache: operands of AND and OR are sorted, so "b | a" and "(a | b)" match.
+struct PlanNode {
+    TokenType type = TT_TERM;
+    const QueryToken* tok = nullptr;
+    std::vector<PlanNode> kids;
+    LexEntry entry;
+    bool found = false;
+    uint64_t est = 0;
+    std::string key;
+    // Set by Evaluator::prepare for operands iterated as a whole: cache hits,
+    // prefix, phrase and NEAR results (docs) and bitmap records (set).
+    DocList docs;
+    DocSet set;
+    bool dense = false;
+};
+
+static bool build_plan(const std::vector<QueryToken>& pf, PlanNode& root) {
+    std::vector<PlanNode> st;
     for (const auto& t : pf) {
-        if (t.type == TT_TERM) {
-            std::vector<uint32_t> v;
-            int idx = lex_find(lex, t.term);
-            if (idx >= 0) read_postings(postings, lex[idx], v);
-            st.push_back(v);
+        if (is_operand(t)) {
+            PlanNode n;
+            n.type = t.type;
+            n.tok = &t;
+            st.push_back(std::move(n));
         } else if (t.type == TT_NOT) {
             if (st.empty()) return false;
-            std::vector<uint32_t> tmp;
-            complement(doc_count, st.back(), tmp);
-            st.pop_back();
-            st.push_back(tmp);
+            if (st.back().type == TT_NOT) {
+                PlanNode x = std::move(st.back().kids[0]);
+                st.back() = std::move(x);
+            } else {
+                PlanNode n;
+                n.type = TT_NOT;
+                n.kids.push_back(std::move(st.back()));
+                st.back() = std::move(n);
+            }
         } else {
             if (st.size() < 2) return false;
-            auto b = st.back(); st.pop_back();
-            auto a = st.back(); st.pop_back();
-            std::vector<uint32_t> r;
-            if (t.type == TT_AND) intersect(a, b, r);
-            else unite(a, b, r);
-            st.push_back(r);
+            PlanNode n;
+            n.type = t.type;
+            for (size_t k = st.size() - 2; k < st.size(); ++k) {
+                if (st[k].type == t.type) {
+                    for (auto& x : st[k].kids) n.kids.push_back(std::move(x));
+                } else {
+                    n.kids.push_back(std::move(st[k]));
+                }
+            }
+            st.pop_back();
+            st.back() = std::move(n);
         }
     }
-
     if (st.size() != 1) return false;
-    out = st.back();
+    root = std::move(st.back());
     return true;
 }
 
-int main(int argc, char** argv) {
-    if (argc < 3) return 1;
+static std::string join_terms(const std::vector<std::string>& v) {
+    std::string out;
+    for (const auto& x : v) out += (out.empty() ? "" : " ") + x;
+    return out;
+}
 
-    std::string index_dir = argv[1];
-    std::string query = argv[2];
+// Looks terms up, fills est and key bottom-up and orders AND operands:
+// positive ones by ascending size, then the negated ones by descending size
+// so the largest exclusions apply first.
+static bool plan_node(PlanNode& n, const Segment& seg) {
+    uint64_t doc_count = seg.docs.size();
+    const QueryToken* t = n.tok;
+    if (n.type == TT_TERM) {
+        n.found = seg.lex.find(t->term, n.entry);
+        n.est = n.found ? n.entry.df : 0;
+        n.key = "t:" + t->term;
+        return true;
+    }
+    if (n.type == TT_PREFIX) {
+        n.est = doc_count;
+        n.key = "p:" + t->term;
+        return true;
+    }
+    if (n.type == TT_PHRASE || n.type == TT_NEAR) {
+        n.est = doc_count;
+        LexEntry e;
+        for (const auto* side : {&t->phrase, &t->right}) {
+            for (const auto& term : *side) {
+                n.est = seg.lex.find(term, e) ? std::min<uint64_t>(n.est, e.df) : 0;
+            }
+        }
+        n.key = (n.type == TT_PHRASE ? "\"" + join_terms(t->phrase) + "\"" :
+                 "n" + std::to_string(t->slop) + "(\"" + join_terms(t->phrase) + "\",\"" +
+                 join_terms(t->right) + "\")");
+        return true;
+    }
 
-    int limit = 20;
-    bool stemming = true;
+    if (n.type == TT_AND) {
+        bool positive = false;
+        for (const auto& k : n.kids) positive |= k.type != TT_NOT;
+        if (!positive) {
+            PlanNode any;
+            any.type = TT_OR;
+            for (auto& k : n.kids) any.kids.push_back(std::move(k.kids[0]));
+            n.type = TT_NOT;
+            n.kids.clear();
+            if (any.kids.size() == 1) n.kids.push_back(std::move(any.kids[0]));
+            else n.kids.push_back(std::move(any));
+        }
+    }
 
-    for (int i = 3; i < argc; ++i) {
-        std::string a = argv[i];
-        if (a == "--limit" && i + 1 < argc) { limit = std::stoi(argv[++i]); }
-        else if (a == "--stemming" && i + 1 < argc) { stemming = (std::string(argv[++i]) == "1"); }
+    std::vector<std::string> keys;
+    for (auto& k : n.kids) {
+        if (!plan_node(k, seg)) return false;
+        keys.push_back(k.key);
     }
 
-    std::vector<LexEntry> lex;
-    if (!load_terms(index_dir + "/terms.bin", lex)) return 2;
+    if (n.type == TT_NOT) {
+        n.est = doc_count - std::min(doc_count, n.kids[0].est);
+        n.key = "!(" + n.kids[0].key + ")";
+        return true;
+    }
 
-    std::vector<std::string> urls, titles;
-    if (!load_docs(index_dir + "/docs.bin", urls, titles)) return 3;
-    uint32_t doc_count = (uint32_t)urls.size();
+    std::sort(keys.begin(), keys.end());
+    n.key = n.type == TT_AND ? "&(" : "|(";
+    for (size_t j = 0; j < keys.size(); ++j) n.key += (j ? "," : "") + keys[j];
+    n.key += ")";
 
-    std::ifstream postings(index_dir + "/postings.bin", std::ios::binary);
-    if (!postings) return 4;
+    if (n.type == TT_OR) {
+        n.est = 0;
+        for (const auto& k : n.kids) n.est += k.est;
+        n.est = std::min(n.est, doc_count);
+        return true;
+    }
 
-    TokenizerConfig tc;
-    tc.lowercase = true;
-    tc.normalize_yo = true;
-    Tokenizer tokenizer(tc);
+    auto negated = [](const PlanNode& k) { return k.type == TT_NOT; };
+    std::stable_sort(n.kids.begin(), n.kids.end(), [&](const PlanNode& a, const PlanNode& b) {
+        if (negated(a) != negated(b)) return negated(b);
+        return negated(a) ? a.kids[0].est > b.kids[0].est : a.est < b.est;
+    });
+    n.est = n.kids[0].est;
+    return true;
+}
+
+constexpr uint32_t kEndDoc = DocSet::kNoDoc;
+
+enum IterKind { IK_CURSOR, IK_LIST, IK_SET, IK_AND, IK_OR, IK_NOT };
+
+// Document-at-a-time view of a plan node: doc is the current match (kEndDoc
+// once exhausted) and advance(target) moves it to the first match >= target.
+// AND leapfrogs its operands through their skip entries, so a caller that
+// stops after k results reads only the blocks those k results need. Phrase
+// and prefix operands and cache hits are iterated as materialized lists.
+struct DocIter {
+    IterKind kind = IK_LIST;
+    uint32_t doc = 0;
+    PostingCursor cursor;
+    DocList list;
+    size_t pos = 0;
+    const DocSet* set = nullptr;
+    // AND: kids[0, positives) must contain the doc and the rest must not.
+    std::vector<DocIter> kids;
+    size_t positives = 0;
+    uint32_t doc_count = 0;
+
+    bool advance(uint32_t target) { return doc >= target || move_to(target); }
+    bool move_to(uint32_t target);
+};
+
+bool DocIter::move_to(uint32_t target) {
+    if (kind == IK_CURSOR) {
+        cursor.seek(target);
+        doc = cursor.done() ? kEndDoc : cursor.doc();
+        return cursor.ok();
+    }
+    if (kind == IK_LIST) {
+        size_t n = list ? list->size() : 0;
+        if (n) pos = std::lower_bound(list->begin() + pos, list->end(), target) - list->begin();
+        doc = pos < n ? (*list)[pos] : kEndDoc;
+        return true;
+    }
+    if (kind == IK_SET) {
+        doc = set->lower_bound(target);
+        return true;
+    }
+    if (kind == IK_OR) {
+        doc = kEndDoc;
+        for (auto& k : kids) {
+            if (!k.advance(target)) return false;
+            doc = std::min(doc, k.doc);
+        }
+        return true;
+    }
+    if (kind == IK_NOT) {
+        for (uint32_t d = target;; ++d) {
+            if (d >= doc_count) {
+                doc = kEndDoc;
+                return true;
+            }
+            if (!kids[0].advance(d)) return false;
+            if (kids[0].doc != d) {
+                doc = d;
+                return true;
+            }
+        }
+    }
+
+    uint32_t d = target;
+    for (bool match = false; !match;) {
+        if (!kids[0].advance(d)) return false;
+        d = kids[0].doc;
+        if (d == kEndDoc) break;
+        match = true;
+        for (size_t i = 1; i < kids.size() && match; ++i) {
+            if (!kids[i].advance(d)) return false;
+            if (i < positives && kids[i].doc != d) {
+                d = kids[i].doc;
+                match = false;
+            } else if (i >= positives && kids[i].doc == d) {
+                ++d;
+                match = false;
+            }
+        }
+    }
+    doc = d;
+    return true;
+}
+
+struct Evaluator {
+    const Segment& seg;
+    QueryCache* cache;
+
+    bool run(const std::vector<QueryToken>& pf, std::vector<uint32_t>& out);
+    // Reads the operands of n that are iterated as a whole, once per query.
+    bool prepare(PlanNode& n);
+    // Builds the iterator for prepared n positioned at its first match >= from.
+    // Needs no lock, so ranges of one query can be opened in parallel.
+    bool open(const PlanNode& n, DocIter& it, uint32_t from) const;
+
+ private:
+    bool eval(const PlanNode& n, Operand& out);
+    bool eval_uncached(const PlanNode& n, Operand& out);
+    bool eval_and(const PlanNode& n, Operand& out);
+    void load(Operand& o);
+    void store(const PlanNode& n, Operand& o);
+};
+
+void Evaluator::store(const PlanNode& n, Operand& o) {
+    if (o.dense) {
+        std::vector<uint32_t> docs;
+        o.set.to_sorted(docs);
+        cache->put(seg.cache_prefix + n.key, std::make_shared<const std::vector<uint32_t>>(std::move(docs)));
+        return;
+    }
+    if (!o.shared) o.shared = std::make_shared<const std::vector<uint32_t>>(std::move(o.docs));
+    cache->put(seg.cache_prefix + n.key, o.shared);
+}
+
+void Evaluator::load(Operand& o) {
+    if (!o.lazy) return;
+    read_postings(seg.postings, seg.version, seg.flags, o.entry, o.docs);
+    o.lazy = false;
+    if (cache) store(*o.node, o);
+}
+
+bool Evaluator::eval(const PlanNode& n, Operand& out) {
+    if (cache) {
+        if (DocList hit = cache->get(seg.cache_prefix + n.key)) {
+            out.shared = std::move(hit);
+            return true;
+        }
+    }
+    if (!eval_uncached(n, out)) return false;
+    // Term lists are cheap to open again, packed or as a bitmap record.
+    if (cache && !out.lazy && n.type != TT_TERM) store(n, out);
+    return true;
+}
+
+// Intersects the positive operands smallest first, probing term lists
+// through their skip entries, then subtracts the negated ones; stops as
+// soon as the result is empty.
+bool Evaluator::eval_and(const PlanNode& n, Operand& out) {
+    Operand cur;
+    if (!eval(n.kids[0], cur)) return false;
+    load(cur);
+
+    std::vector<uint32_t> tmp;
+    DocSet set;
+    for (size_t i = 1; i < n.kids.size() && !cur.empty(); ++i) {
+        bool negated = n.kids[i].type == TT_NOT;
+        Operand o;
+        if (!eval(negated ? n.kids[i].kids[0] : n.kids[i], o)) return false;
+        if (cur.dense) {
+            load(o);
+            if (!o.dense) DocSet::from_sorted(o.ids(), o.set);
+            if (negated) {
+                DocSet::diff(cur.set, o.set, set);
+            } else {
+                DocSet::intersect(cur.set, o.set, set);
+            }
+            cur.set = std::move(set);
+            continue;
+        }
+        if (o.dense) {
+            tmp.clear();
+            for (uint32_t d : cur.ids()) {
+                if (o.set.contains(d) != negated) tmp.push_back(d);
+            }
+        } else if (o.lazy) {
+            PostingCursor c;
+            if (!c.open(seg.postings, seg.version, seg.flags, o.entry)) return false;
+            if (!(negated ? diff_probe(cur.ids(), c, tmp) : intersect_probe(cur.ids(), c, tmp))) return false;
+        } else if (negated) {
+            diff(cur.ids(), o.ids(), tmp);
+        } else {
+            intersect(cur.ids(), o.ids(), tmp);
+        }
+        cur.shared.reset();
+        cur.docs.swap(tmp);
+    }
+    out.docs = std::move(cur.docs);
+    out.shared = std::move(cur.shared);
+    out.set = std::move(cur.set);
+    out.dense = cur.dense;
+    return true;
+}
+
+bool Evaluator::eval_uncached(const PlanNode& n, Operand& out) {
+    const QueryToken* t = n.tok;
+    if (n.type == TT_TERM) {
+        if (n.found && n.entry.bm_bytes > 0) {
+            if (!seg.bitmaps.contains(n.entry.bm_offset, n.entry.bm_bytes)) return false;
+            out.dense = out.set.decode(seg.bitmaps.data() + n.entry.bm_offset, n.entry.bm_bytes);
+            return out.dense;
+        }
+        out.lazy = n.found;
+        out.entry = n.entry;
+        out.node = &n;
+        return true;
+    }
+    if (n.type == TT_PREFIX) return eval_prefix(*t, seg, out.docs);
+    if (n.type == TT_PHRASE || n.type == TT_NEAR) return eval_positional(*t, seg, out.docs);
+    if (n.type == TT_AND) return eval_and(n, out);
+
+    if (n.type == TT_NOT) {
+        Operand a;
+        if (!eval(n.kids[0], a)) return false;
+        load(a);
+        if (a.dense) {
+            // Deleted ids stay in the set; run() drops them from the result.
+            DocSet::complement(a.set, seg.docs.size(), out.set);
+            out.dense = true;
+        } else {
+            complement(seg.docs.size(), seg.deleted, a.ids(), out.docs);
+        }
+        return true;
+    }
+
+    // Packed lists are merged as vectors, bitmap records as sets; the two
+    // are joined once at the end.
+    std::vector<uint32_t> tmp;
+    DocSet set;
+    for (const auto& k : n.kids) {
+        Operand o;
+        if (!eval(k, o)) return false;
+        load(o);
+        if (o.dense) {
+            DocSet::unite(out.set, o.set, set);
+            out.set = std::move(set);
+            out.dense = true;
+        } else {
+            unite(out.docs, o.ids(), tmp);
+            out.docs.swap(tmp);
+        }
+    }
+    if (out.dense && !out.docs.empty()) {
+        DocSet packed;
+        DocSet::from_sorted(out.docs, packed);
+        DocSet::unite(out.set, packed, set);
+        out.set = std::move(set);
+        out.docs.clear();
+    }
+    return true;
+}
+
+bool Evaluator::run(const std::vector<QueryToken>& pf, std::vector<uint32_t>& out) {
+    PlanNode root;
+    if (!build_plan(pf, root) || !plan_node(root, seg)) return false;
+
+    Operand r;
+    if (!eval(root, r)) return false;
+    load(r);
+    if (r.dense) {
+        r.set.to_sorted(r.docs);
+        r.shared.reset();
+    }
+    out.clear();
+    for (uint32_t d : r.ids()) {
+        if (!is_deleted(seg.deleted, d)) out.push_back(d);
+    }
+    return true;
+}
+
+bool Evaluator::prepare(PlanNode& n) {
+    // NOT is cheap to iterate, and AND reads its negated operands directly.
+    if (cache && n.type != TT_NOT && (n.docs = cache->get(seg.cache_prefix + n.key))) return true;
+    if (n.type == TT_TERM) {
+        if (!n.found || n.entry.bm_bytes == 0) return true;
+        if (!seg.bitmaps.contains(n.entry.bm_offset, n.entry.bm_bytes)) return false;
+        n.dense = n.set.decode(seg.bitmaps.data() + n.entry.bm_offset, n.entry.bm_bytes);
+        return n.dense;
+    }
+    if (n.type == TT_AND || n.type == TT_OR || n.type == TT_NOT) {
+        for (auto& k : n.kids) {
+            if (!prepare(k)) return false;
+        }
+        return true;
+    }
+    Operand o;
+    if (!eval_uncached(n, o)) return false;
+    if (cache) store(n, o);
+    n.docs = o.shared ? o.shared : std::make_shared<const std::vector<uint32_t>>(std::move(o.docs));
+    return true;
+}
+
+bool Evaluator::open(const PlanNode& n, DocIter& it, uint32_t from) const {
+    if (n.docs) {
+        it.kind = IK_LIST;
+        it.list = n.docs;
+    } else if (n.dense) {
+        it.kind = IK_SET;
+        it.set = &n.set;
+    } else if (n.type == TT_TERM && n.found) {
+        it.kind = IK_CURSOR;
+        if (!it.cursor.open(seg.postings, seg.version, seg.flags, n.entry)) return false;
+    } else if (n.type == TT_TERM) {
+        it.kind = IK_LIST;
+    } else if (n.type == TT_AND || n.type == TT_OR || n.type == TT_NOT) {
+        it.kind = n.type == TT_AND ? IK_AND : n.type == TT_OR ? IK_OR : IK_NOT;
+        it.doc_count = seg.docs.size();
+        it.kids.resize(n.kids.size());
+        for (size_t i = 0; i < n.kids.size(); ++i) {
+            bool negated = n.type == TT_AND && n.kids[i].type == TT_NOT;
+            if (!negated) it.positives = i + 1;
+            if (!open(negated ? n.kids[i].kids[0] : n.kids[i], it.kids[i], from)) return false;
+        }
+    } else {
+        return false;
+    }
+    return it.move_to(from);
+}
+
+static bool eval_postfix(const std::vector<QueryToken>& pf,
+                         const Segment& seg,
+                         QueryCache* cache,
+                         std::vector<uint32_t>& out) {
+    Evaluator ev{seg, cache};
+    return ev.run(pf, out);
+}
+
+static int open_segment(const std::string& dir, Segment& seg) {
+    if (!seg.lex.open(dir + "/terms.bin")) return 2;
+    seg.version = seg.lex.version();
+    seg.flags = seg.lex.flags();
+    if (!seg.docs.open(dir + "/docs.bin")) return 3;
+    if (!seg.postings.open(dir + "/postings.bin")) return 4;
+    if ((seg.flags & kBidxFlagPositions) && !seg.positions.open(dir + "/positions.bin")) return 4;
+    if (seg.flags & kBidxFlagFreqs) {
+        if (!seg.freqs.open(dir + "/freqs.bin") ||
+            !map_doc_lens(dir, seg.doc_lens_file, seg.doc_lens, seg.doc_lens_count)) return 4;
+    }
+    if ((seg.flags & kBidxFlagBitmaps) && !seg.bitmaps.open(dir + "/bitmaps.bin")) return 4;
+    load_deleted(dir, seg.deleted);
+    return 0;
+}
+
+static void conjuncts(const std::vector<QueryToken>& pf, const std::vector<size_t>& starts,
+                      size_t root, std::vector<size_t>& out) {
+    if (pf[root].type != TT_AND) {
+        out.push_back(root);
+        return;
+    }
+    conjuncts(pf, starts, starts[root - 1] - 1, out);
+    conjuncts(pf, starts, root - 1, out);
+}
+
+static bool pure_or(const std::vector<QueryToken>& pf, const std::vector<size_t>& starts, size_t root) {
+    for (size_t i = starts[root]; i <= root; ++i) {
+        if (pf[i].type != TT_TERM && pf[i].type != TT_PREFIX && pf[i].type != TT_OR) return false;
+    }
+    return true;
+}
+
+// BM25 collection statistics: documents, their total length and the df of
+// every query term, summed over the segments (or shards) they come from.
+struct RankStats {
+    uint64_t doc_count = 0;
+    uint64_t total_len = 0;
+    std::map<std::string, uint64_t> dfs;
+};
+
+// Scores the terms that occur un-negated in the query with BM25 and keeps the
+// top `limit` documents. The boolean expression still filters: for the usual
+// shape "(a | b ...) & !x & !y" only the negated parts are evaluated and
+// subtracted, otherwise the whole expression is evaluated as an allow list.
+// idf and avgdl are computed over all segments so scores are comparable.
+// Behind a coordinator they must be comparable across shards too: with
+// collect only the statistics are summed into it, and with global the
+// scores use those sums instead of this index's.
+static int search_ranked(const std::vector<Segment>& segs,
+                         const std::vector<QueryToken>& pf,
+                         int limit,
+                         QueryCache* cache,
+                         RankStats* collect,
+                         const RankStats* global,
+                         std::ostream& out) {
+    std::vector<size_t> starts;
+    if (!subtree_starts(pf, starts)) return 6;
+    for (const auto& seg : segs) {
+        if (!(seg.flags & kBidxFlagFreqs)) return 7;
+    }
+
+    std::vector<bool> negated(pf.size(), false);
+    for (size_t i = 0; i < pf.size(); ++i) {
+        if (pf[i].type != TT_NOT) continue;
+        for (size_t j = starts[i]; j < i; ++j) negated[j] = !negated[j];
+    }
+    std::vector<std::string> terms;
+    auto add_term = [&](const std::string& t) {
+        if (std::find(terms.begin(), terms.end(), t) == terms.end()) terms.push_back(t);
+    };
+    std::vector<LexEntry> expanded;
+    for (size_t i = 0; i < pf.size(); ++i) {
+        if (negated[i]) continue;
+        if (pf[i].type == TT_TERM) add_term(pf[i].term);
+        for (const auto& t : pf[i].phrase) add_term(t);
+        for (const auto& t : pf[i].right) add_term(t);
+        if (pf[i].type != TT_PREFIX) continue;
+        for (const auto& seg : segs) {
+            if (!seg.lex.find_prefix(pf[i].term, expanded)) return 4;
+            for (const auto& e : expanded) add_term(e.term);
+        }
+    }
+
+    std::vector<size_t> conj;
+    conjuncts(pf, starts, pf.size() - 1, conj);
+    bool shaped = true;
+    bool has_core = false;
+    std::vector<std::vector<QueryToken>> negs;
+    for (size_t e : conj) {
+        if (pf[e].type == TT_NOT) {
+            negs.emplace_back(pf.begin() + starts[e], pf.begin() + e);
+        } else if (!has_core && pure_or(pf, starts, e)) {
+            has_core = true;
+        } else {
+            shaped = false;
+        }
+    }
+    shaped &= has_core;
+
+    uint64_t doc_count = 0, total_len = 0;
+    std::vector<uint64_t> dfs(terms.size(), 0);
+    LexEntry e;
+    for (const auto& seg : segs) {
+        doc_count += seg.doc_lens_count;
+        for (uint32_t i = 0; i < seg.doc_lens_count; ++i) total_len += seg.doc_lens[i];
+        for (size_t t = 0; t < terms.size(); ++t) {
+            if (seg.lex.find(terms[t], e)) dfs[t] += e.df;
+        }
+    }
+    if (collect) {
+        collect->doc_count += doc_count;
+        collect->total_len += total_len;
+        for (size_t t = 0; t < terms.size(); ++t) collect->dfs[terms[t]] += dfs[t];
+        return 0;
+    }
+    if (global) {
+        doc_count = global->doc_count;
+        total_len = global->total_len;
+        for (size_t t = 0; t < terms.size(); ++t) {
+            auto it = global->dfs.find(terms[t]);
+            if (it != global->dfs.end()) dfs[t] = it->second;
+        }
+    }
+
+    Bm25 bm25;
+    bm25.avgdl = doc_count ? std::max(1.0, (double)total_len / (double)doc_count) : 1.0;
+    TopK top((size_t)limit);
+
+    for (const auto& seg : segs) {
+        std::vector<TermCursor> cursors;
+        for (size_t t = 0; t < terms.size(); ++t) {
+            if (!seg.lex.find(terms[t], e)) continue;
+            TermCursor c;
+            if (!c.list.open(seg.postings, seg.version, seg.flags, e, &seg.freqs)) return 4;
+            c.idf = Bm25::idf(doc_count, dfs[t]);
+            c.ub = c.idf * bm25.tf_part(e.max_tf, e.min_dl);
+            cursors.push_back(std::move(c));
+        }
+
+        std::vector<uint32_t> allow, deny, v, tmp;
+        DocFilter filter;
+        filter.deleted = &seg.deleted;
+        if (shaped) {
+            for (const auto& n : negs) {
+                if (!eval_postfix(n, seg, cache, v)) return 6;
+                unite(deny, v, tmp);
+                deny.swap(tmp);
+            }
+            filter.deny = &deny;
+        } else {
+            if (!eval_postfix(pf, seg, cache, allow)) return 6;
+            filter.allow = &allow;
+        }
+
+        wand_top_k(cursors, bm25, seg.doc_lens, seg.doc_lens_count, seg.info.doc_base, filter, top);
+    }
+
+    std::vector<ScoredDoc> best;
+    top.sorted(best);
+    out << std::fixed << std::setprecision(4);
+    for (const auto& r : best) {
+        for (const auto& seg : segs) {
+            uint32_t d = r.doc - seg.info.doc_base;
+            if (r.doc < seg.info.doc_base || d >= seg.docs.size()) continue;
+            std::string_view url = seg.docs.url(d);
+            std::string_view title = seg.docs.title(d);
+            out << r.doc << "\t" << url << "\t" << (title.empty() ? url : title) << "\t" << r.score << "\n";
+            break;
+        }
+    }
+    return 0;
+}
+
+// Cache keys start with the segment name and the generation of the opened
+// index, so results computed on a segment before a reload are never served
+// after it.
+// A sharded index directory lists as the segments of all its shards, each
+// already at its global doc id offset.
+static bool list_index_segments(const std::string& index_dir, std::vector<SegmentInfo>& infos) {
+    std::vector<SegmentInfo> shards;
+    if (!load_manifest(index_dir, shards, "shards.txt")) return list_segments(index_dir, infos);
+    infos.clear();
+    std::vector<SegmentInfo> segs;
+    for (const auto& sh : shards) {
+        if (!list_segments(index_dir + "/" + sh.name, segs)) return false;
+        for (auto& s : segs) {
+            s.name = s.name == "." ? sh.name : sh.name + "/" + s.name;
+            infos.push_back(s);
+        }
+    }
+    return true;
+}
+
+static int open_index(const std::string& index_dir, std::vector<Segment>& segs, uint64_t generation = 0) {
+    std::vector<SegmentInfo> infos;
+    if (!list_index_segments(index_dir, infos)) return 2;
+    segs = std::vector<Segment>(infos.size());
+    for (size_t s = 0; s < infos.size(); ++s) {
+        segs[s].info = infos[s];
+        segs[s].cache_prefix = std::to_string(generation) + "/" + infos[s].name + "\t";
+        int rc = open_segment(segment_dir(index_dir, infos[s]), segs[s]);
+        if (rc) return rc;
+    }
+    return 0;
+}
+
+static void print_hit(const Segment& seg, uint32_t d, std::ostream& out) {
+    std::string_view url = seg.docs.url(d);
+    std::string_view title = seg.docs.title(d);
+    out << seg.info.doc_base + d << "\t" << url << "\t" << (title.empty() ? url : title) << "\n";
+}
+
+static bool shown_doc(const Segment& seg, uint32_t d) {
+    return d < seg.docs.size() && !is_deleted(seg.deleted, d);
+}
+
+// Segments smaller than this are not split.
+constexpr uint32_t kMinRangeDocs = 1u << 14;
+
+// One doc id range of one segment. found is -1 until the range is done.
+// With a cache, all keeps every match and complete says the range was
+// evaluated to its end.
+struct RangeTask {
+    size_t seg = 0;
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    std::vector<uint32_t> docs;
+    std::vector<uint32_t> all;
+    bool complete = false;
+    bool list = false;
+    std::atomic<int> found{-1};
+};
+
+// Splits every segment into up to 4 ranges per thread and evaluates them on
+// the pool. A range keeps at most limit results, and a range is skipped once
+// the finished ranges before it hold limit results already. The results are
+// printed in range order. A segment whose ranges all ran to their end is
+// cached like in the sequential path.
+static int search_boolean_parallel(const std::vector<Segment>& segs,
+                                   std::vector<PlanNode>& roots,
+                                   int limit,
+                                   QueryCache* cache,
+                                   WorkPool& pool,
+                                   std::ostream& out) {
+    size_t count = 0;
+    for (const auto& seg : segs) {
+        uint32_t n = seg.docs.size();
+        count += std::min<size_t>(4 * (size_t)pool.threads(), std::max<uint32_t>(1, n / kMinRangeDocs));
+    }
+    std::unique_ptr<RangeTask[]> tasks(new RangeTask[count]);
+    for (size_t s = 0, t = 0; s < segs.size(); ++s) {
+        uint32_t n = segs[s].docs.size();
+        size_t parts = std::min<size_t>(4 * (size_t)pool.threads(), std::max<uint32_t>(1, n / kMinRangeDocs));
+        for (size_t p = 0; p < parts; ++p, ++t) {
+            tasks[t].seg = s;
+            tasks[t].begin = (uint32_t)((uint64_t)n * p / parts);
+            tasks[t].end = (uint32_t)((uint64_t)n * (p + 1) / parts);
+        }
+    }
+
+    std::atomic<bool> failed{false};
+    pool.run(count, [&](size_t i) {
+        RangeTask& task = tasks[i];
+        int before = 0;
+        for (size_t j = 0; j < i && before < limit; ++j) {
+            int f = tasks[j].found.load();
+            if (f < 0) {
+                before = -1;
+                break;
+            }
+            before += f;
+        }
+        if (before < limit) {
+            const Segment& seg = segs[task.seg];
+            Evaluator ev{seg, cache};
+            DocIter it;
+            bool ok = ev.open(roots[task.seg], it, task.begin);
+            while (ok && it.doc < task.end && (int)task.docs.size() < limit) {
+                if (cache) task.all.push_back(it.doc);
+                if (shown_doc(seg, it.doc)) task.docs.push_back(it.doc);
+                ok = it.advance(it.doc + 1);
+            }
+            if (!ok) failed = true;
+            task.complete = ok && it.doc >= task.end;
+            task.list = it.kind == IK_LIST;
+        }
+        task.found = (int)task.docs.size();
+    });
+    if (failed) return 6;
+
+    for (size_t t = 0; cache && t < count;) {
+        size_t e = t;
+        bool complete = true;
+        for (; e < count && tasks[e].seg == tasks[t].seg; ++e) complete &= tasks[e].complete && !tasks[e].list;
+        if (complete) {
+            std::vector<uint32_t> all;
+            for (size_t k = t; k < e; ++k) all.insert(all.end(), tasks[k].all.begin(), tasks[k].all.end());
+            const Segment& seg = segs[tasks[t].seg];
+            cache->put(seg.cache_prefix + roots[tasks[t].seg].key,
+                       std::make_shared<const std::vector<uint32_t>>(std::move(all)));
+        }
+        t = e;
+    }
+
+    int shown = 0;
+    for (size_t t = 0; t < count && shown < limit; ++t) {
+        for (size_t k = 0; k < tasks[t].docs.size() && shown < limit; ++k, ++shown) {
+            print_hit(segs[tasks[t].seg], tasks[t].docs[k], out);
+        }
+    }
+    return 0;
+}
+
+static int search_boolean(const std::vector<Segment>& segs,
+                          const std::vector<QueryToken>& pf,
+                          int limit,
+                          QueryCache* cache,
+                          WorkPool* pool,
+                          std::ostream& out) {
+    std::vector<PlanNode> roots(segs.size());
+    auto plan = [&](size_t s) {
+        Evaluator ev{segs[s], cache};
+        return build_plan(pf, roots[s]) && plan_node(roots[s], segs[s]) && ev.prepare(roots[s]);
+    };
+    if (pool && pool->threads() > 1) {
+        for (size_t s = 0; s < segs.size(); ++s) {
+            if (!plan(s)) return 6;
+        }
+        return search_boolean_parallel(segs, roots, limit, cache, *pool, out);
+    }
+
+    int shown = 0;
+    for (size_t s = 0; s < segs.size() && shown < limit; ++s) {
+        const Segment& seg = segs[s];
+        Evaluator ev{seg, cache};
+        DocIter it;
+        if (!plan(s) || !ev.open(roots[s], it, 0)) return 6;
+
+        // Matches are cached only when the query ran to the end of the segment.
+        std::vector<uint32_t> all;
+        while (it.doc != kEndDoc && shown < limit) {
+            uint32_t d = it.doc;
+            if (cache) all.push_back(d);
+            if (shown_doc(seg, d)) {
+                print_hit(seg, d, out);
+                ++shown;
+            }
+            if (!it.advance(d + 1)) return 6;
+        }
+        if (cache && it.doc == kEndDoc && it.kind != IK_LIST) {
+            cache->put(seg.cache_prefix + roots[s].key, std::make_shared<const std::vector<uint32_t>>(std::move(all)));
+        }
+    }
+    return 0;
+}
+
+struct QueryParser {
+    Tokenizer tokenizer;
     RussianStemmer stemmer;
+    bool stemming = true;
+
+    explicit QueryParser(const TokenizerConfig& tc) : tokenizer(tc) {}
+};
 
+static int parse_query(const QueryParser& qp, const std::string& query, bool ranked, std::vector<QueryToken>& pf) {
     std::vector<QueryToken> toks;
-    tokenize_query(query, toks, tokenizer, stemmer, stemming);
+    tokenize_query(query, toks, qp.tokenizer, qp.stemmer, qp.stemming);
+    if (!fold_near(toks)) return 5;
+    if (ranked) add_implicit_or(toks);
+    return to_postfix(toks, pf) ? 0 : 5;
+}
 
+static int run_query(const std::vector<Segment>& segs, const QueryParser& qp, QueryCache* cache,
+                     WorkPool* pool, const std::string& query, bool ranked, int limit, std::ostream& out,
+                     const RankStats* global = nullptr) {
     std::vector<QueryToken> pf;
-    if (!to_postfix(toks, pf)) return 5;
+    int rc = parse_query(qp, query, ranked, pf);
+    if (rc) return rc;
+    if (limit <= 0 || pf.empty()) return 0;
+    return ranked ? search_ranked(segs, pf, limit, cache, nullptr, global, out)
+                  : search_boolean(segs, pf, limit, cache, pool, out);
+}
 
-    std::vector<uint32_t> res;
-    if (!eval_postfix(pf, doc_count, lex, postings, res)) return 6;
+// The ranked query's collection statistics in this index, for a coordinator.
+static int query_stats(const std::vector<Segment>& segs, const QueryParser& qp, const std::string& query,
+                       RankStats& st) {
+    std::vector<QueryToken> pf;
+    int rc = parse_query(qp, query, true, pf);
+    if (rc || pf.empty()) return rc;
+    std::ostringstream unused;
+    return search_ranked(segs, pf, 1, nullptr, &st, nullptr, unused);
+}
 
-    int shown = 0;
-    for (uint32_t d : res) {
-        if (shown >= limit) break;
-        if (d >= doc_count) continue;
-        std::string title = titles[d].empty() ? urls[d] : titles[d];
-        std::cout << d << "\t" << urls[d] << "\t" << title << "\n";
-        ++shown;
+static TokenizerConfig query_tokenizer_config() {
+    TokenizerConfig tc;
+    tc.lowercase = true;
+    tc.normalize_yo = true;
+    return tc;
+}
+
+// Requests: "SEARCH <limit> <query>", "RANKED <limit> <query>", "STATS",
+// "RELOAD" (see refresh_index) or "PING". Replies: "OK <n>" followed by n
+// result lines as printed by a one-shot search, or "ERR <code>" with the exit
+// code the one-shot search would give. A coordinator ranks in two rounds:
+// "TERMSTATS <query>" replies with "<docs>\t<total length>" and one
+// "<term>\t<df>" line per query term, and "GRANKED <limit> <docs> <total
+// length> <n> <term> <df>... <query>" ranks with those sums in place of this
+// index's own.
+static std::string handle_request(const std::vector<Segment>& segs, const QueryParser& qp,
+                                  QueryCache* cache, WorkPool* pool, const std::string& line) {
+    if (line == "PING") return "OK 0\n";
+    if (line.compare(0, 10, "TERMSTATS ") == 0) {
+        RankStats st;
+        int rc = query_stats(segs, qp, line.substr(10), st);
+        if (rc) return "ERR " + std::to_string(rc) + "\n";
+        std::string body = std::to_string(st.doc_count) + "\t" + std::to_string(st.total_len) + "\n";
+        for (const auto& d : st.dfs) body += d.first + "\t" + std::to_string(d.second) + "\n";
+        return "OK " + std::to_string(st.dfs.size() + 1) + "\n" + body;
+    }
+    if (line.compare(0, 8, "GRANKED ") == 0) {
+        std::istringstream in(line.substr(8));
+        int limit = 0;
+        size_t n = 0;
+        RankStats st;
+        if (!(in >> limit >> st.doc_count >> st.total_len >> n)) return "ERR 1\n";
+        for (size_t i = 0; i < n; ++i) {
+            std::string term;
+            uint64_t df;
+            if (!(in >> term >> df)) return "ERR 1\n";
+            st.dfs[term] = df;
+        }
+        std::string query;
+        std::getline(in, query);
+        std::ostringstream body;
+        int rc = run_query(segs, qp, cache, pool, query, true, limit, body, &st);
+        if (rc) return "ERR " + std::to_string(rc) + "\n";
+        std::string text = body.str();
+        return "OK " + std::to_string(std::count(text.begin(), text.end(), '\n')) + "\n" + text;
+    }
+    if (line == "STATS") {
+        CacheStats st = cache ? cache->stats() : CacheStats();
+        return "OK 1\nhits=" + std::to_string(st.hits) + "\tmisses=" + std::to_string(st.misses) +
+               "\tinserts=" + std::to_string(st.inserts) + "\tevictions=" + std::to_string(st.evictions) +
+               "\tentries=" + std::to_string(st.entries) + "\tbytes=" + std::to_string(st.bytes) + "\n";
     }
 
-    return 0;
+    size_t sp1 = line.find(' ');
+    size_t sp2 = (sp1 == std::string::npos) ? sp1 : line.find(' ', sp1 + 1);
+    std::string cmd = line.substr(0, sp1);
+    if (sp2 == std::string::npos || (cmd != "SEARCH" && cmd != "RANKED")) return "ERR 1\n";
+    int limit;
+    try {
+        limit = std::stoi(line.substr(sp1 + 1, sp2 - sp1 - 1));
+    } catch (...) {
+        return "ERR 1\n";
+    }
+
+    std::ostringstream body;
+    int rc = run_query(segs, qp, cache, pool, line.substr(sp2 + 1), cmd == "RANKED", limit, body);
+    if (rc) return "ERR " + std::to_string(rc) + "\n";
+    std::string text = body.str();
+    size_t n = (size_t)std::count(text.begin(), text.end(), '\n');
+    return "OK " + std::to_string(n) + "\n" + text;
+}
+
+// The index a server answers from. Requests take a snapshot, so a reload
+// never pulls segments from under a running query.
+struct LiveIndex {
+    std::string dir;
+    std::mutex mu;
+    std::shared_ptr<const std::vector<Segment>> segs;
+    std::string stamp;
+    uint64_t generation = 0;
+    std::atomic<int64_t> next_check{0};
+};
+
+// How often the index files are checked for changes.
+constexpr int64_t kStampCheckMs = 1000;
+
+static void stamp_file(const std::string& path, std::string& stamp) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        stamp += "-\n";
+        return;
+    }
+    stamp += std::to_string(st.st_ino) + " " + std::to_string(st.st_size) + " " +
+             std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec) + "\n";
+}
+
+// segments.txt changes when segments are added or merged, a deleted.bin when
+// documents are deleted, and a segment's terms.bin and docs.bin when it is
+// rebuilt in place (terms.bin is replaced last, see publish_segment_files).
+static std::string index_stamp(const std::string& dir, const std::vector<Segment>& segs) {
+    std::string stamp;
+    stamp_file(dir + "/segments.txt", stamp);
+    stamp_file(dir + "/shards.txt", stamp);
+    for (const auto& seg : segs) {
+        std::string d = segment_dir(dir, seg.info);
+        stamp_file(d + "/deleted.bin", stamp);
+        stamp_file(d + "/terms.bin", stamp);
+        stamp_file(d + "/docs.bin", stamp);
+    }
+    return stamp;
+}
+
+// Checked before a request at most every kStampCheckMs, by one request at a
+// time: if the files changed since the index was opened (or on "RELOAD"), the
+// index is opened again and the cache is cleared. If it cannot be opened, e.g.
+// during a rewrite, the old snapshot keeps serving and the next check retries.
+static int refresh_index(LiveIndex& live, QueryCache* cache, bool force,
+                         std::shared_ptr<const std::vector<Segment>>& out) {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t due = live.next_check.load(std::memory_order_relaxed);
+    bool check = force || (now >= due && live.next_check.compare_exchange_strong(due, now + kStampCheckMs));
+
+    std::lock_guard<std::mutex> lk(live.mu);
+    int rc = 0;
+    if (check && (force || index_stamp(live.dir, *live.segs) != live.stamp)) {
+        auto segs = std::make_shared<std::vector<Segment>>();
+        rc = open_index(live.dir, *segs, live.generation + 1);
+        if (rc == 0) {
+            ++live.generation;
+            live.segs = segs;
+            live.stamp = index_stamp(live.dir, *segs);
+            if (cache) cache->clear();
+        }
+    }
+    out = live.segs;
+    return rc;
+}
+
+// serve <index_dir> [--socket PATH | --port N] [--threads N] [--stemming 0|1]
+//       [--cache_mb N] [--query_threads N]
+static int serve(int argc, char** argv) {
+    std::string index_dir = argv[2];
+    ServerConfig cfg;
+    QueryParser qp(query_tokenizer_config());
+    size_t cache_mb = 64;
+    int query_threads = 1;
+
+    for (int i = 3; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--socket" && i + 1 < argc) { cfg.socket_path = argv[++i]; }
+        else if (a == "--port" && i + 1 < argc) { cfg.port = (uint16_t)std::stoi(argv[++i]); }
+        else if (a == "--threads" && i + 1 < argc) { cfg.threads = std::stoi(argv[++i]); }
+        else if (a == "--stemming" && i + 1 < argc) { qp.stemming = (std::string(argv[++i]) == "1"); }
+        else if (a == "--cache_mb" && i + 1 < argc) { cache_mb = (size_t)std::stoul(argv[++i]); }
+        else if (a == "--query_threads" && i + 1 < argc) { query_threads = std::stoi(argv[++i]); }
+    }
+    if (cfg.socket_path.empty() && cfg.port == 0) return 1;
+
+    LiveIndex live;
+    live.dir = index_dir;
+    auto segs = std::make_shared<std::vector<Segment>>();
+    int rc = open_index(index_dir, *segs);
+    if (rc) return rc;
+    live.segs = segs;
+    live.stamp = index_stamp(index_dir, *segs);
+
+    QueryCache cache(cache_mb << 20);
+    QueryCache* cp = cache_mb ? &cache : nullptr;
+    WorkPool pool(query_threads);
+    return run_server(cfg, [&](const std::string& line) {
+        std::shared_ptr<const std::vector<Segment>> current;
+        int rc = refresh_index(live, cp, line == "RELOAD", current);
+        if (line == "RELOAD") return rc ? "ERR " + std::to_string(rc) + "\n" : std::string("OK 0\n");
+        return handle_request(*current, qp, cp, &pool, line);
+    }) ? 8 : 0;
+}
+
+struct ShardHit {
+    uint32_t doc;
+    double score;
+    std::string line;
+};
+
+// Splits the result lines off an "OK <n>" reply.
+static void parse_hits(const std::string& reply, bool ranked, std::vector<ShardHit>& hits) {
+    for (size_t p = reply.find('\n') + 1; p < reply.size();) {
+        size_t nl = reply.find('\n', p);
+        ShardHit h;
+        h.line = reply.substr(p, nl - p + 1);
+        h.doc = (uint32_t)std::strtoul(h.line.c_str(), nullptr, 10);
+        h.score = ranked ? std::strtod(h.line.c_str() + h.line.rfind('\t') + 1, nullptr) : 0.0;
+        hits.push_back(std::move(h));
+        p = nl + 1;
+    }
+}
+
+// Sends the request to every shard. Returns the first shard error, ERR 9 if
+// a shard is unreachable, or an empty string when all replied OK.
+static std::string broadcast(std::vector<std::unique_ptr<ServerClient>>& shards, const std::string& line,
+                             std::vector<std::string>& replies) {
+    std::vector<ServerClient::Call> calls(shards.size());
+    for (size_t s = 0; s < shards.size(); ++s) shards[s]->send(line, calls[s]);
+    replies.assign(shards.size(), std::string());
+    bool reached = true;
+    for (size_t s = 0; s < shards.size(); ++s) reached &= shards[s]->receive(calls[s], replies[s]);
+    if (!reached) return "ERR 9\n";
+    for (const auto& r : replies) {
+        if (r.compare(0, 3, "OK ") != 0) return r;
+    }
+    return std::string();
+}
+
+// Turns "RANKED <limit> <query>" into the GRANKED request that makes every
+// shard score with the collection statistics summed over all shards, so the
+// merged top-k is the one a single index would give.
+static std::string global_ranked(std::vector<std::unique_ptr<ServerClient>>& shards, const std::string& line,
+                                 std::string& granked) {
+    size_t sp = line.find(' ', 7);
+    if (sp == std::string::npos) return "ERR 1\n";
+    std::vector<std::string> replies;
+    std::string err = broadcast(shards, "TERMSTATS " + line.substr(sp + 1), replies);
+    if (!err.empty()) return err;
+
+    RankStats st;
+    for (const auto& r : replies) {
+        std::istringstream in(r.substr(r.find('\n') + 1));
+        uint64_t docs = 0, len = 0, df = 0;
+        in >> docs >> len;
+        st.doc_count += docs;
+        st.total_len += len;
+        for (std::string term; in >> term >> df;) st.dfs[term] += df;
+    }
+    granked = "GRANKED " + line.substr(7, sp - 7) + " " + std::to_string(st.doc_count) + " " +
+              std::to_string(st.total_len) + " " + std::to_string(st.dfs.size());
+    for (const auto& d : st.dfs) granked += " " + d.first + " " + std::to_string(d.second);
+    granked += " " + line.substr(sp + 1);
+    return std::string();
+}
+
+// Sends the request to every shard and merges the replies the way one index
+// would order them: boolean hits by global doc id, ranked hits by score and
+// then doc id, cut to the limit. A ranked request first collects the
+// collection statistics from all shards (global_ranked), so the scores match
+// an unsharded index. The first shard error is passed on; ERR 9 if a shard is
+// unreachable.
+static std::string handle_coordinated(std::vector<std::unique_ptr<ServerClient>>& shards,
+                                      const std::string& line) {
+    if (line.compare(0, 10, "TERMSTATS ") == 0 || line.compare(0, 8, "GRANKED ") == 0) return "ERR 1\n";
+    std::string request = line;
+    if (line.compare(0, 7, "RANKED ") == 0) {
+        std::string err = global_ranked(shards, line, request);
+        if (!err.empty()) return err;
+    }
+    std::vector<std::string> replies;
+    std::string err = broadcast(shards, request, replies);
+    if (!err.empty()) return err;
+
+    if (line == "PING" || line == "RELOAD") return "OK 0\n";
+    if (line == "STATS") {
+        std::string body;
+        for (size_t s = 0; s < shards.size(); ++s) {
+            body += "shard=" + std::to_string(s) + "\t" + replies[s].substr(replies[s].find('\n') + 1);
+        }
+        return "OK " + std::to_string(shards.size()) + "\n" + body;
+    }
+
+    // The shards accepted it, so it is "SEARCH <limit> ..." or "RANKED <limit> ...".
+    bool ranked = line.compare(0, 7, "RANKED ") == 0;
+    long limit = std::strtol(line.c_str() + 7, nullptr, 10);
+    std::vector<ShardHit> hits;
+    for (const auto& r : replies) parse_hits(r, ranked, hits);
+    std::sort(hits.begin(), hits.end(), [ranked](const ShardHit& a, const ShardHit& b) {
+        if (ranked && a.score != b.score) return a.score > b.score;
+        return a.doc < b.doc;
+    });
+    if (hits.size() > (size_t)std::max(0L, limit)) hits.resize((size_t)std::max(0L, limit));
+
+    std::string out = "OK " + std::to_string(hits.size()) + "\n";
+    for (const auto& h : hits) out += h.line;
+    return out;
+}
+
+// coordinate <endpoint>[,<endpoint>...] [--socket PATH | --port N] [--threads N]
+// Serves the same protocol in front of one server per shard of an index built
+// with --shards; an endpoint is a socket path or a TCP port.
+static int coordinate(int argc, char** argv) {
+    ServerConfig cfg;
+    std::vector<std::unique_ptr<ServerClient>> shards;
+    std::stringstream list(argv[2]);
+    for (std::string ep; std::getline(list, ep, ',');) {
+        if (!ep.empty()) shards.push_back(std::make_unique<ServerClient>(ep));
+    }
+
+    for (int i = 3; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--socket" && i + 1 < argc) { cfg.socket_path = argv[++i]; }
+        else if (a == "--port" && i + 1 < argc) { cfg.port = (uint16_t)std::stoi(argv[++i]); }
+        else if (a == "--threads" && i + 1 < argc) { cfg.threads = std::stoi(argv[++i]); }
+    }
+    if (shards.empty() || (cfg.socket_path.empty() && cfg.port == 0)) return 1;
+    return run_server(cfg, [&](const std::string& line) { return handle_coordinated(shards, line); }) ? 8 : 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) return 1;
+    if (std::string(argv[1]) == "serve") return serve(argc, argv);
+    if (std::string(argv[1]) == "coordinate") return coordinate(argc, argv);
+
+    std::string index_dir = argv[1];
+    std::string query = argv[2];
+
+    int limit = 20;
+    bool ranked = false;
+    int query_threads = 1;
+    QueryParser qp(query_tokenizer_config());
+
+    for (int i = 3; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--limit" && i + 1 < argc) { limit = std::stoi(argv[++i]); }
+        else if (a == "--stemming" && i + 1 < argc) { qp.stemming = (std::string(argv[++i]) == "1"); }
+        else if (a == "--ranked" && i + 1 < argc) { ranked = (std::string(argv[++i]) == "1"); }
+        else if (a == "--query_threads" && i + 1 < argc) { query_threads = std::stoi(argv[++i]); }
+    }
+
+    std::vector<Segment> segs;
+    int rc = open_index(index_dir, segs);
+    if (rc) return rc;
+    WorkPool pool(query_threads);
+    return run_query(segs, qp, nullptr, &pool, query, ranked, limit, std::cout);
 }
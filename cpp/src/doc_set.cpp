@@ -0,0 +1,296 @@
+#include "doc_set.h"
+
+#include <algorithm>
+#include <cstring>
+
+static uint32_t popcount_words(const std::vector<uint64_t>& w) {
+    uint32_t n = 0;
+    for (uint64_t x : w) n += (uint32_t)__builtin_popcountll(x);
+    return n;
+}
+
+// Bitmap chunks with few ids turn into arrays and arrays that outgrow
+// kArrayMax into bitmaps; empty chunks are dropped by the callers.
+void DocSet::normalize(Chunk& c) {
+    if (c.bitmap()) {
+        c.count = popcount_words(c.bits);
+        if (c.count > kArrayMax) return;
+        c.array.clear();
+        for (uint32_t w = 0; w < kBitmapWords; ++w) {
+            for (uint64_t x = c.bits[w]; x; x &= x - 1) {
+                c.array.push_back((uint16_t)(w * 64 + (uint32_t)__builtin_ctzll(x)));
+            }
+        }
+        c.bits.clear();
+        c.bits.shrink_to_fit();
+        return;
+    }
+    c.count = (uint32_t)c.array.size();
+    if (c.count <= kArrayMax) return;
+    to_bitmap(c, c.bits);
+    c.array.clear();
+    c.array.shrink_to_fit();
+}
+
+void DocSet::to_bitmap(const Chunk& c, std::vector<uint64_t>& bits) {
+    if (c.bitmap()) {
+        bits = c.bits;
+        return;
+    }
+    bits.assign(kBitmapWords, 0);
+    for (uint16_t v : c.array) bits[v >> 6] |= 1ull << (v & 63);
+}
+
+void DocSet::from_sorted(const std::vector<uint32_t>& docs, DocSet& out) {
+    out.chunks_.clear();
+    for (size_t i = 0; i < docs.size(); ) {
+        Chunk c;
+        c.key = (uint16_t)(docs[i] >> kChunkBits);
+        for (; i < docs.size() && (docs[i] >> kChunkBits) == c.key; ++i) {
+            c.array.push_back((uint16_t)docs[i]);
+        }
+        normalize(c);
+        out.chunks_.push_back(std::move(c));
+    }
+}
+
+void DocSet::encode(const std::vector<uint32_t>& docs, std::string& out) {
+    DocSet s;
+    from_sorted(docs, s);
+    auto put = [&](const void* p, size_t n) { out.append(reinterpret_cast<const char*>(p), n); };
+    uint32_t n = (uint32_t)s.chunks_.size();
+    put(&n, 4);
+    for (const auto& c : s.chunks_) {
+        uint16_t kind = c.bitmap() ? 1 : 0;
+        put(&c.key, 2);
+        put(&kind, 2);
+        put(&c.count, 4);
+    }
+    for (const auto& c : s.chunks_) {
+        if (c.bitmap()) put(c.bits.data(), c.bits.size() * sizeof(uint64_t));
+        else put(c.array.data(), c.array.size() * sizeof(uint16_t));
+    }
+}
+
+bool DocSet::decode(const uint8_t* p, size_t n) {
+    chunks_.clear();
+    if (n < 4) return false;
+    uint32_t count;
+    std::memcpy(&count, p, 4);
+    if ((n - 4) / 8 < count) return false;
+    const uint8_t* head = p + 4;
+    const uint8_t* body = head + (size_t)count * 8;
+    const uint8_t* end = p + n;
+
+    chunks_.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        Chunk& c = chunks_[i];
+        uint16_t kind;
+        std::memcpy(&c.key, head + i * 8, 2);
+        std::memcpy(&kind, head + i * 8 + 2, 2);
+        std::memcpy(&c.count, head + i * 8 + 4, 4);
+        size_t bytes = kind ? kBitmapWords * sizeof(uint64_t) : (size_t)c.count * sizeof(uint16_t);
+        if ((size_t)(end - body) < bytes || (i && c.key <= chunks_[i - 1].key)) return false;
+        if (kind) {
+            c.bits.resize(kBitmapWords);
+            std::memcpy(c.bits.data(), body, bytes);
+        } else {
+            c.array.resize(c.count);
+            std::memcpy(c.array.data(), body, bytes);
+        }
+        body += bytes;
+    }
+    return true;
+}
+
+void DocSet::to_sorted(std::vector<uint32_t>& out) const {
+    out.clear();
+    out.reserve(size());
+    for (const auto& c : chunks_) {
+        uint32_t base = (uint32_t)c.key << kChunkBits;
+        if (!c.bitmap()) {
+            for (uint16_t v : c.array) out.push_back(base | v);
+            continue;
+        }
+        for (uint32_t w = 0; w < kBitmapWords; ++w) {
+            for (uint64_t x = c.bits[w]; x; x &= x - 1) {
+                out.push_back(base | (w * 64 + (uint32_t)__builtin_ctzll(x)));
+            }
+        }
+    }
+}
+
+bool DocSet::contains(uint32_t d) const {
+    uint16_t key = (uint16_t)(d >> kChunkBits);
+    auto it = std::lower_bound(chunks_.begin(), chunks_.end(), key,
+                               [](const Chunk& c, uint16_t k) { return c.key < k; });
+    if (it == chunks_.end() || it->key != key) return false;
+    uint16_t v = (uint16_t)d;
+    if (it->bitmap()) return (it->bits[v >> 6] >> (v & 63)) & 1;
+    return std::binary_search(it->array.begin(), it->array.end(), v);
+}
+
+uint32_t DocSet::lower_bound(uint32_t d) const {
+    uint16_t key = (uint16_t)(d >> kChunkBits);
+    auto it = std::lower_bound(chunks_.begin(), chunks_.end(), key,
+                               [](const Chunk& c, uint16_t k) { return c.key < k; });
+    for (; it != chunks_.end(); ++it) {
+        uint32_t base = (uint32_t)it->key << kChunkBits;
+        uint32_t low = it->key == key ? (uint16_t)d : 0;
+        if (it->bitmap()) {
+            uint64_t x = it->bits[low >> 6] & (~0ull << (low & 63));
+            for (uint32_t w = low >> 6;;) {
+                if (x) return base + w * 64 + (uint32_t)__builtin_ctzll(x);
+                if (++w == kBitmapWords) break;
+                x = it->bits[w];
+            }
+        } else {
+            auto p = std::lower_bound(it->array.begin(), it->array.end(), (uint16_t)low);
+            if (p != it->array.end()) return base + *p;
+        }
+    }
+    return kNoDoc;
+}
+
+uint64_t DocSet::size() const {
+    uint64_t n = 0;
+    for (const auto& c : chunks_) n += c.count;
+    return n;
+}
+
+void DocSet::chunk_and(const Chunk& a, const Chunk& b, Chunk& out) {
+    out.key = a.key;
+    if (a.bitmap() && b.bitmap()) {
+        out.bits.resize(kBitmapWords);
+        for (uint32_t w = 0; w < kBitmapWords; ++w) out.bits[w] = a.bits[w] & b.bits[w];
+    } else if (a.bitmap() || b.bitmap()) {
+        const Chunk& arr = a.bitmap() ? b : a;
+        const Chunk& bm = a.bitmap() ? a : b;
+        for (uint16_t v : arr.array) {
+            if ((bm.bits[v >> 6] >> (v & 63)) & 1) out.array.push_back(v);
+        }
+    } else {
+        std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                              std::back_inserter(out.array));
+    }
+    normalize(out);
+}
+
+void DocSet::chunk_or(const Chunk& a, const Chunk& b, Chunk& out) {
+    out.key = a.key;
+    if (a.bitmap() || b.bitmap()) {
+        to_bitmap(a.bitmap() ? a : b, out.bits);
+        const Chunk& other = a.bitmap() ? b : a;
+        if (other.bitmap()) {
+            for (uint32_t w = 0; w < kBitmapWords; ++w) out.bits[w] |= other.bits[w];
+        } else {
+            for (uint16_t v : other.array) out.bits[v >> 6] |= 1ull << (v & 63);
+        }
+    } else {
+        std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                       std::back_inserter(out.array));
+    }
+    normalize(out);
+}
+
+void DocSet::chunk_andnot(const Chunk& a, const Chunk& b, Chunk& out) {
+    out.key = a.key;
+    if (a.bitmap()) {
+        out.bits = a.bits;
+        if (b.bitmap()) {
+            for (uint32_t w = 0; w < kBitmapWords; ++w) out.bits[w] &= ~b.bits[w];
+        } else {
+            for (uint16_t v : b.array) out.bits[v >> 6] &= ~(1ull << (v & 63));
+        }
+    } else if (b.bitmap()) {
+        for (uint16_t v : a.array) {
+            if (!((b.bits[v >> 6] >> (v & 63)) & 1)) out.array.push_back(v);
+        }
+    } else {
+        std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                            std::back_inserter(out.array));
+    }
+    normalize(out);
+}
+
+void DocSet::intersect(const DocSet& a, const DocSet& b, DocSet& out) {
+    out.chunks_.clear();
+    size_t i = 0, j = 0;
+    while (i < a.chunks_.size() && j < b.chunks_.size()) {
+        if (a.chunks_[i].key < b.chunks_[j].key) { ++i; continue; }
+        if (a.chunks_[i].key > b.chunks_[j].key) { ++j; continue; }
+        Chunk c;
+        chunk_and(a.chunks_[i++], b.chunks_[j++], c);
+        if (c.count) out.chunks_.push_back(std::move(c));
+    }
+}
+
+void DocSet::unite(const DocSet& a, const DocSet& b, DocSet& out) {
+    out.chunks_.clear();
+    size_t i = 0, j = 0;
+    while (i < a.chunks_.size() || j < b.chunks_.size()) {
+        if (j == b.chunks_.size() || (i < a.chunks_.size() && a.chunks_[i].key < b.chunks_[j].key)) {
+            out.chunks_.push_back(a.chunks_[i++]);
+        } else if (i == a.chunks_.size() || b.chunks_[j].key < a.chunks_[i].key) {
+            out.chunks_.push_back(b.chunks_[j++]);
+        } else {
+            Chunk c;
+            chunk_or(a.chunks_[i++], b.chunks_[j++], c);
+            out.chunks_.push_back(std::move(c));
+        }
+    }
+}
+
+void DocSet::diff(const DocSet& a, const DocSet& b, DocSet& out) {
+    out.chunks_.clear();
+    size_t j = 0;
+    for (const auto& c : a.chunks_) {
+        while (j < b.chunks_.size() && b.chunks_[j].key < c.key) ++j;
+        if (j == b.chunks_.size() || b.chunks_[j].key != c.key) {
+            out.chunks_.push_back(c);
+            continue;
+        }
+        Chunk r;
+        chunk_andnot(c, b.chunks_[j], r);
+        if (r.count) out.chunks_.push_back(std::move(r));
+    }
+}
+
+void DocSet::complement(const DocSet& a, uint32_t doc_count, DocSet& out) {
+    out.chunks_.clear();
+    if (!doc_count) return;
+    uint32_t last_key = (doc_count - 1) >> kChunkBits;
+    size_t j = 0;
+    for (uint32_t key = 0; key <= last_key; ++key) {
+        Chunk full;
+        full.key = (uint16_t)key;
+        full.bits.assign(kBitmapWords, ~0ull);
+        if (key == last_key) {
+            uint32_t n = doc_count - (key << kChunkBits);
+            for (uint32_t w = 0; w < kBitmapWords; ++w) {
+                if (w * 64 >= n) full.bits[w] = 0;
+                else if (w * 64 + 64 > n) full.bits[w] = (1ull << (n - w * 64)) - 1;
+            }
+        }
+        while (j < a.chunks_.size() && a.chunks_[j].key < key) ++j;
+        Chunk r;
+        if (j < a.chunks_.size() && a.chunks_[j].key == key) {
+            chunk_andnot(full, a.chunks_[j], r);
+        } else {
+            r = std::move(full);
+            normalize(r);
+        }
+        if (r.count) out.chunks_.push_back(std::move(r));
+    }
+}
+
+bool has_dense_chunk(const std::vector<uint32_t>& docs) {
+    for (size_t i = 0; i < docs.size(); ) {
+        uint32_t key = docs[i] >> kChunkBits;
+        size_t j = i;
+        while (j < docs.size() && (docs[j] >> kChunkBits) == key) ++j;
+        if (j - i > kArrayMax) return true;
+        i = j;
+    }
+    return false;
+}
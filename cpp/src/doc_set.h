@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Roaring-style doc id set: ids are split into chunks of 2^16 by their high
+// bits. A chunk with at most kArrayMax ids is a sorted array of the low 16
+// bits, a denser one a bitmap of kBitmapWords 64-bit words, so AND, OR and
+// NOT over dense chunks are word-wide operations.
+constexpr uint32_t kChunkBits = 16;
+constexpr uint32_t kArrayMax = 4096;
+constexpr uint32_t kBitmapWords = (1u << kChunkBits) / 64;
+
+class DocSet {
+ public:
+  static void from_sorted(const std::vector<uint32_t>& docs, DocSet& out);
+  // Record layout (bitmaps.bin): u32 chunk count; per chunk u16 key, u16
+  // kind (0 array, 1 bitmap), u32 id count; then every chunk's payload in
+  // the same order: count u16 values or kBitmapWords u64 words.
+  static void encode(const std::vector<uint32_t>& docs, std::string& out);
+  bool decode(const uint8_t* p, size_t n);
+
+  static constexpr uint32_t kNoDoc = 0xFFFFFFFFu;
+
+  void to_sorted(std::vector<uint32_t>& out) const;
+  bool contains(uint32_t d) const;
+  // Smallest id >= d, or kNoDoc.
+  uint32_t lower_bound(uint32_t d) const;
+  uint64_t size() const;
+  bool empty() const { return chunks_.empty(); }
+
+  static void intersect(const DocSet& a, const DocSet& b, DocSet& out);
+  static void unite(const DocSet& a, const DocSet& b, DocSet& out);
+  static void diff(const DocSet& a, const DocSet& b, DocSet& out);
+  // Ids in [0, doc_count) that are not in a.
+  static void complement(const DocSet& a, uint32_t doc_count, DocSet& out);
+
+ private:
+  struct Chunk {
+    uint16_t key = 0;
+    uint32_t count = 0;
+    std::vector<uint16_t> array;
+    std::vector<uint64_t> bits;
+    bool bitmap() const { return !bits.empty(); }
+  };
+
+  static void normalize(Chunk& c);
+  static void to_bitmap(const Chunk& c, std::vector<uint64_t>& bits);
+  static void chunk_and(const Chunk& a, const Chunk& b, Chunk& out);
+  static void chunk_or(const Chunk& a, const Chunk& b, Chunk& out);
+  static void chunk_andnot(const Chunk& a, const Chunk& b, Chunk& out);
+
+  std::vector<Chunk> chunks_;
+};
+
+// True if some chunk of the sorted ids would be stored as a bitmap.
+bool has_dense_chunk(const std::vector<uint32_t>& docs);
@@ -0,0 +1,936 @@
+#include "index_io.h"
+#include "doc_set.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+void write_u16(std::ofstream& out, uint16_t x) { out.write(reinterpret_cast<char*>(&x), sizeof(x)); }
+void write_u32(std::ofstream& out, uint32_t x) { out.write(reinterpret_cast<char*>(&x), sizeof(x)); }
+void write_u64(std::ofstream& out, uint64_t x) { out.write(reinterpret_cast<char*>(&x), sizeof(x)); }
+
+uint16_t read_u16(std::ifstream& in) { uint16_t x = 0; in.read(reinterpret_cast<char*>(&x), sizeof(x)); return x; }
+uint32_t read_u32(std::ifstream& in) { uint32_t x = 0; in.read(reinterpret_cast<char*>(&x), sizeof(x)); return x; }
+uint64_t read_u64(std::ifstream& in) { uint64_t x = 0; in.read(reinterpret_cast<char*>(&x), sizeof(x)); return x; }
+
+static bool starts_with(const std::string& s, const std::string& prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Bounds-checked reader over mapped bytes.
+struct ByteReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    bool has(size_t n) {
+        ok = ok && (size_t)(end - p) >= n;
+        return ok;
+    }
+    uint16_t u16() { if (!has(2)) return 0; uint16_t x = load_u16(p); p += 2; return x; }
+    uint32_t u32() { if (!has(4)) return 0; uint32_t x = load_u32(p); p += 4; return x; }
+    uint64_t u64() { if (!has(8)) return 0; uint64_t x = load_u64(p); p += 8; return x; }
+};
+
+static bool load_flat_terms(ByteReader& in, uint32_t version, uint32_t flags, uint32_t n,
+                            std::vector<LexEntry>& lex) {
+    lex.clear();
+    lex.reserve(n);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        uint16_t len = in.u16();
+        if (!in.has(len)) return false;
+        LexEntry e{std::string(reinterpret_cast<const char*>(in.p), len), 0, 0, 0};
+        in.p += len;
+        e.offset = in.u64();
+        e.df = in.u32();
+        e.bytes = (version == kBidxVersionBlocked) ? in.u32() : e.df * (uint32_t)sizeof(uint32_t);
+        if (flags & kBidxFlagPositions) {
+            e.pos_offset = in.u64();
+            e.pos_bytes = in.u32();
+        }
+        if (flags & kBidxFlagFreqs) {
+            e.freq_offset = in.u64();
+            e.freq_bytes = in.u32();
+            e.max_tf = in.u32();
+            e.min_dl = in.u32();
+        }
+        if (flags & kBidxFlagBitmaps) {
+            e.bm_offset = in.u64();
+            e.bm_bytes = in.u32();
+        }
+        if (!in.ok) return false;
+        lex.push_back(std::move(e));
+    }
+    return true;
+}
+
+bool load_terms(const std::string& path, std::vector<LexEntry>& lex,
+                uint32_t& version, uint32_t& flags) {
+    Lexicon l;
+    if (!l.open(path)) return false;
+    version = l.version();
+    flags = l.flags();
+    return l.read_all(lex);
+}
+
+bool Lexicon::open(const std::string& path) {
+    if (!file_.open(path)) return false;
+    ByteReader in{file_.data(), file_.data() + file_.size()};
+    if (!in.has(4) || std::memcmp(in.p, "BIDX", 4) != 0) return false;
+    in.p += 4;
+
+    version_ = in.u32();
+    if (version_ != kBidxVersionRaw && version_ != kBidxVersionBlocked) return false;
+    flags_ = (version_ == kBidxVersionBlocked) ? in.u32() : 0;
+    uint32_t n = in.u32();
+    size_ = n;
+
+    if (!(flags_ & kBidxFlagFrontCoded)) {
+        bool ok = load_flat_terms(in, version_, flags_, n, all_);
+        file_.close();
+        return ok;
+    }
+
+    blocks_ = in.u32();
+    index_ = in.u64();
+    if (!in.ok || !(flags_ & kBidxFlagBlockTable) || !file_.contains(index_, 0)) return false;
+
+    uint64_t table = (uint64_t)(blocks_ + 1) * (sizeof(uint64_t) + sizeof(uint32_t));
+    if (!file_.contains(index_, table)) return false;
+    table_ = file_.data() + index_;
+    terms_ = table_ + table;
+    return file_.contains(index_ + table, load_u32(table_ + (blocks_ + 1) * 8 + blocks_ * 4));
+}
+
+uint64_t Lexicon::block_offset(size_t b) const {
+    return load_u64(table_ + b * 8);
+}
+
+std::string_view Lexicon::first_term(size_t b) const {
+    const uint8_t* offs = table_ + (blocks_ + 1) * 8;
+    uint32_t from = load_u32(offs + b * 4);
+    uint32_t to = load_u32(offs + (b + 1) * 4);
+    if (to < from) to = from;
+    return std::string_view(reinterpret_cast<const char*>(terms_) + from, to - from);
+}
+
+// Index of the last block whose first term is <= term (strictly less with
+// strict), or blocks_ if there is none.
+size_t Lexicon::find_block(std::string_view term, bool strict) const {
+    size_t l = 0, r = blocks_;
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        std::string_view first = first_term(m);
+        if (strict ? first < term : first <= term) l = m + 1;
+        else r = m;
+    }
+    return l == 0 ? blocks_ : l - 1;
+}
+
+bool Lexicon::read_block(size_t b, std::vector<LexEntry>& out) const {
+    out.clear();
+    uint64_t from = block_offset(b);
+    uint64_t to = block_offset(b + 1);
+    if (to < from || !file_.contains(from, to - from)) return false;
+
+    const uint8_t* p = file_.data() + from;
+    const uint8_t* end = file_.data() + to;
+    uint64_t offset = 0, pos_offset = 0, freq_offset = 0, bm_offset = 0;
+    auto take64 = [&](uint64_t& x) {
+        if (end - p < 8) return false;
+        x = load_u64(p);
+        p += 8;
+        return true;
+    };
+    if (!take64(offset)) return false;
+    if ((flags_ & kBidxFlagPositions) && !take64(pos_offset)) return false;
+    if ((flags_ & kBidxFlagFreqs) && !take64(freq_offset)) return false;
+    if ((flags_ & kBidxFlagBitmaps) && !take64(bm_offset)) return false;
+
+    std::string term;
+    while (p < end) {
+        uint32_t shared, len;
+        if (!get_varint(p, end, shared) || !get_varint(p, end, len)) return false;
+        if (shared > term.size() || (uint64_t)(end - p) < len) return false;
+        term.resize(shared);
+        term.append(reinterpret_cast<const char*>(p), len);
+        p += len;
+
+        LexEntry e{term, offset, 0, 0};
+        bool ok = get_varint(p, end, e.df) && get_varint(p, end, e.bytes);
+        offset += e.bytes;
+        if (flags_ & kBidxFlagPositions) {
+            ok = ok && get_varint(p, end, e.pos_bytes);
+            e.pos_offset = pos_offset;
+            pos_offset += e.pos_bytes;
+        }
+        if (flags_ & kBidxFlagFreqs) {
+            ok = ok && get_varint(p, end, e.freq_bytes) && get_varint(p, end, e.max_tf) &&
+                 get_varint(p, end, e.min_dl);
+            e.freq_offset = freq_offset;
+            freq_offset += e.freq_bytes;
+        }
+        if (flags_ & kBidxFlagBitmaps) {
+            ok = ok && get_varint(p, end, e.bm_bytes);
+            e.bm_offset = bm_offset;
+            bm_offset += e.bm_bytes;
+        }
+        if (!ok) return false;
+        out.push_back(std::move(e));
+    }
+    return true;
+}
+
+bool Lexicon::find(const std::string& term, LexEntry& out) const {
+    if (!(flags_ & kBidxFlagFrontCoded)) {
+        int i = lex_find(all_, term);
+        if (i < 0) return false;
+        out = all_[i];
+        return true;
+    }
+
+    size_t b = find_block(term, false);
+    std::vector<LexEntry> block;
+    if (b == blocks_ || !read_block(b, block)) return false;
+    for (const auto& e : block) {
+        if (e.term == term) {
+            out = e;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Lexicon::find_prefix(const std::string& prefix, std::vector<LexEntry>& out) const {
+    out.clear();
+    if (!(flags_ & kBidxFlagFrontCoded)) {
+        auto it = std::lower_bound(all_.begin(), all_.end(), prefix,
+                                   [](const LexEntry& e, const std::string& t) { return e.term < t; });
+        for (; it != all_.end() && starts_with(it->term, prefix); ++it) out.push_back(*it);
+        return true;
+    }
+
+    size_t b = find_block(prefix, true);
+    if (b == blocks_) b = 0;
+    std::vector<LexEntry> block;
+    for (; b < blocks_; ++b) {
+        if (!read_block(b, block)) return false;
+        for (auto& e : block) {
+            if (e.term < prefix) continue;
+            if (!starts_with(e.term, prefix)) return true;
+            out.push_back(std::move(e));
+        }
+    }
+    return true;
+}
+
+bool Lexicon::read_all(std::vector<LexEntry>& out) const {
+    if (!(flags_ & kBidxFlagFrontCoded)) {
+        out = all_;
+        return true;
+    }
+    out.clear();
+    out.reserve(size_);
+    std::vector<LexEntry> block;
+    for (size_t b = 0; b < blocks_; ++b) {
+        if (!read_block(b, block)) return false;
+        for (auto& e : block) out.push_back(std::move(e));
+    }
+    return out.size() == size_;
+}
+
+bool read_terms_header(const std::string& path, uint32_t& version, uint32_t& flags) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    char magic[4];
+    in.read(magic, 4);
+    if (std::string(magic, 4) != "BIDX") return false;
+    version = read_u32(in);
+    flags = (version == kBidxVersionBlocked) ? read_u32(in) : 0;
+    return static_cast<bool>(in);
+}
+
+int lex_find(const std::vector<LexEntry>& lex, const std::string& term) {
+    int l = 0;
+    int r = (int)lex.size() - 1;
+    while (l <= r) {
+        int m = l + (r - l) / 2;
+        if (lex[m].term == term) return m;
+        if (lex[m].term < term) l = m + 1;
+        else r = m - 1;
+    }
+    return -1;
+}
+
+void read_postings(std::ifstream& in, uint32_t version, uint32_t flags, const LexEntry& e,
+                   std::vector<uint32_t>& out) {
+    in.seekg((std::streamoff)e.offset);
+    if (version == kBidxVersionBlocked) {
+        std::string buf(e.bytes, '\0');
+        if (e.bytes) in.read(&buf[0], e.bytes);
+        uint32_t table = skip_table_bytes(e.df, flags);
+        if (!in || table > buf.size() ||
+            !decode_postings(reinterpret_cast<const uint8_t*>(buf.data()) + table,
+                             buf.size() - table, e.df, out)) out.clear();
+        return;
+    }
+    out.resize(e.df);
+    if (e.df) in.read(reinterpret_cast<char*>(out.data()),
+                      e.df * sizeof(uint32_t));
+}
+
+bool read_positions(std::ifstream& in, const LexEntry& e, PositionLists& out) {
+    std::string buf(e.pos_bytes, '\0');
+    in.seekg((std::streamoff)e.pos_offset);
+    if (e.pos_bytes) in.read(&buf[0], e.pos_bytes);
+    if (!in) return false;
+    return decode_positions(reinterpret_cast<const uint8_t*>(buf.data()), buf.size(), e.df, out);
+}
+
+bool read_freqs(std::ifstream& in, const LexEntry& e, std::vector<uint32_t>& out) {
+    std::string buf(e.freq_bytes, '\0');
+    in.seekg((std::streamoff)e.freq_offset);
+    if (e.freq_bytes) in.read(&buf[0], e.freq_bytes);
+    if (!in) return false;
+    return decode_freqs(reinterpret_cast<const uint8_t*>(buf.data()), buf.size(), e.df, out);
+}
+
+void read_postings(const MappedFile& postings, uint32_t version, uint32_t flags,
+                   const LexEntry& e, std::vector<uint32_t>& out) {
+    out.clear();
+    if (!postings.contains(e.offset, e.bytes)) return;
+    const uint8_t* p = postings.data() + e.offset;
+    if (version == kBidxVersionBlocked) {
+        uint32_t table = skip_table_bytes(e.df, flags);
+        if (table > e.bytes || !decode_postings(p + table, e.bytes - table, e.df, out)) out.clear();
+        return;
+    }
+    if ((uint64_t)e.df * sizeof(uint32_t) > e.bytes) return;
+    out.resize(e.df);
+    if (e.df) std::memcpy(out.data(), p, e.df * sizeof(uint32_t));
+}
+
+bool PostingCursor::open(const MappedFile& postings, uint32_t version, uint32_t flags,
+                         const LexEntry& e, const MappedFile* freqs) {
+    freqs_ = freqs;
+    entry_ = e;
+    df_ = e.df;
+    idx_ = 0;
+    first_ = 0;
+    block_ = 0;
+    tfs_loaded_ = false;
+    ok_ = true;
+    skips_ = nullptr;
+    words_ = 0;
+    if (!postings.contains(e.offset, e.bytes)) {
+        fail();
+        return false;
+    }
+
+    const uint8_t* p = postings.data() + e.offset;
+    uint32_t table = (version == kBidxVersionBlocked) ? skip_table_bytes(e.df, flags) : 0;
+    if (!table) {
+        blocks_ = df_ ? 1 : 0;
+        count_ = df_;
+        if (version == kBidxVersionBlocked) {
+            read_postings(postings, version, flags, e, owned_);
+            docs_ = owned_.data();
+            if (owned_.size() != df_) fail();
+        } else if ((uint64_t)df_ * sizeof(uint32_t) > e.bytes ||
+                   reinterpret_cast<uintptr_t>(p) % alignof(uint32_t)) {
+            fail();
+        } else {
+            docs_ = reinterpret_cast<const uint32_t*>(p);
+        }
+        last_ = (ok_ && df_) ? docs_[df_ - 1] : 0;
+        return ok_;
+    }
+
+    if (table > e.bytes) {
+        fail();
+        return false;
+    }
+    words_ = skip_entry_words(flags);
+    blocks_ = table / (words_ * (uint32_t)sizeof(uint32_t));
+    skips_ = p;
+    data_ = p + table;
+    end_ = p + e.bytes;
+    owned_.resize(kPostingsBlock);
+    docs_ = owned_.data();
+    return load(0);
+}
+
+bool PostingCursor::load(uint32_t b) {
+    block_ = b;
+    tfs_loaded_ = false;
+    if (!skips_) return true;
+
+    first_ = b * kPostingsBlock;
+    count_ = std::min(kPostingsBlock, df_ - first_);
+    uint32_t from = b ? skip(b - 1, 1) : 0;
+    uint32_t to = skip(b, 1);
+    if (to < from || to > (uint32_t)(end_ - data_)) {
+        fail();
+        return false;
+    }
+    const uint8_t* p = data_ + from;
+    uint32_t next = b ? skip(b - 1, 0) + 1 : 0;
+    if (!decode_postings_block(p, data_ + to, count_, next, owned_.data())) {
+        fail();
+        return false;
+    }
+    return true;
+}
+
+uint32_t PostingCursor::tf() {
+    if (!tfs_loaded_) {
+        tfs_loaded_ = true;
+        bool ok = false;
+        if (freqs_ && freqs_->contains(entry_.freq_offset, entry_.freq_bytes)) {
+            const uint8_t* p = freqs_->data() + entry_.freq_offset;
+            if (!skips_) {
+                ok = decode_freqs(p, entry_.freq_bytes, df_, tfs_);
+            } else {
+                uint32_t from = block_ ? skip(block_ - 1, 2) : 0;
+                uint32_t to = skip(block_, 2);
+                const uint8_t* q = p + from;
+                tfs_.resize(count_);
+                ok = from <= to && to <= entry_.freq_bytes &&
+                     decode_freqs_block(q, p + to, count_, tfs_.data());
+            }
+        }
+        if (!ok) tfs_.assign(count_, 1);
+    }
+    return tfs_[idx_ - first_];
+}
+
+void PostingCursor::next() {
+    if (++idx_ < df_ && idx_ - first_ >= count_) load(block_ + 1);
+}
+
+uint32_t PostingCursor::find_block(uint32_t target) const {
+    uint32_t l = block_, r = blocks_;
+    while (l < r) {
+        uint32_t m = l + (r - l) / 2;
+        if (block_last(m) < target) l = m + 1;
+        else r = m;
+    }
+    return l == blocks_ ? kNoBlock : l;
+}
+
+void PostingCursor::seek(uint32_t target) {
+    if (done() || doc() >= target) return;
+    if (target > block_last(block_)) {
+        uint32_t b = find_block(target);
+        if (b == kNoBlock) {
+            idx_ = df_;
+            return;
+        }
+        if (!load(b)) return;
+        idx_ = first_;
+    }
+    const uint32_t* begin = docs_ + (idx_ - first_);
+    idx_ = first_ + (uint32_t)(std::lower_bound(begin, docs_ + count_, target) - docs_);
+}
+
+bool PositionCursor::open(const MappedFile& positions, const LexEntry& e) {
+    nblocks_ = (e.df + kPostingsBlock - 1) / kPostingsBlock;
+    uint32_t table = nblocks_ * (uint32_t)sizeof(uint32_t);
+    if (e.pos_bytes < table || !positions.contains(e.pos_offset, e.pos_bytes)) return false;
+    blocks_ = positions.data() + e.pos_offset;
+    records_ = blocks_ + table;
+    records_bytes_ = e.pos_bytes - table;
+    return true;
+}
+
+bool PositionCursor::get(uint32_t idx, std::vector<uint32_t>& out) {
+    uint32_t b = idx / kPostingsBlock;
+    if (b >= nblocks_) return false;
+    uint32_t from = load_u32(blocks_ + b * 4);
+    uint32_t to = (b + 1 < nblocks_) ? load_u32(blocks_ + (b + 1) * 4) : records_bytes_;
+    if (to < from || to > records_bytes_) return false;
+    const uint8_t* p = records_ + from;
+    const uint8_t* end = records_ + to;
+    for (uint32_t k = b * kPostingsBlock; k < idx; ++k) {
+        if (!decode_position_record(p, end, nullptr)) return false;
+    }
+    return decode_position_record(p, end, &out);
+}
+
+static const size_t kDocsHeader = 12;
+
+bool DocStore::open(const std::string& path) {
+    if (!file_.open(path)) return false;
+    ByteReader in{file_.data(), file_.data() + file_.size()};
+    if (!in.has(4) || std::memcmp(in.p, "DOCS", 4) != 0) return false;
+    in.p += 4;
+    uint32_t ver = in.u32();
+    count_ = in.u32();
+    if (!in.ok) return false;
+
+    if (ver == 2) {
+        uint64_t table = ((uint64_t)count_ + 1) * sizeof(uint64_t);
+        if (!file_.contains(kDocsHeader, table)) return false;
+        offsets_ = file_.data() + kDocsHeader;
+        return file_.contains(0, load_u64(offsets_ + table - sizeof(uint64_t)));
+    }
+    if (ver != 1) return false;
+
+    // Version 1 has no offset table: find the records with one scan.
+    scanned_.resize((size_t)count_ + 1);
+    for (uint32_t i = 0; i < count_; ++i) {
+        scanned_[i] = (uint64_t)(in.p - file_.data());
+        for (int k = 0; k < 2; ++k) {
+            uint16_t len = in.u16();
+            if (!in.has(len)) return false;
+            in.p += len;
+        }
+    }
+    scanned_[count_] = (uint64_t)(in.p - file_.data());
+    return true;
+}
+
+uint64_t DocStore::record(uint32_t d) const {
+    return offsets_ ? load_u64(offsets_ + (size_t)d * sizeof(uint64_t)) : scanned_[d];
+}
+
+// Field k (0 url, 1 title) of record d.
+std::string_view DocStore::field(uint32_t d, int k) const {
+    if (d >= count_) return {};
+    uint64_t at = record(d), end = record(d + 1);
+    if (end > file_.size()) return {};
+    for (;; --k) {
+        if (at + 2 > end) return {};
+        uint16_t len = load_u16(file_.data() + at);
+        if (at + 2 + len > end) return {};
+        if (k == 0) return std::string_view(reinterpret_cast<const char*>(file_.data() + at + 2), len);
+        at += 2 + len;
+    }
+}
+
+bool save_docs(const std::string& path,
+               const std::vector<std::string>& urls,
+               const std::vector<std::string>& titles) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+
+    uint32_t n = (uint32_t)urls.size();
+    out.write("DOCS", 4);
+    write_u32(out, 2);
+    write_u32(out, n);
+
+    uint64_t at = kDocsHeader + ((uint64_t)n + 1) * sizeof(uint64_t);
+    for (uint32_t i = 0; i <= n; ++i) {
+        write_u64(out, at);
+        if (i == n) break;
+        at += 4 + std::min<size_t>(urls[i].size(), 65535) + std::min<size_t>(titles[i].size(), 65535);
+    }
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const auto& u = urls[i];
+        const auto& t = titles[i];
+
+        uint16_t ul = static_cast<uint16_t>(std::min<size_t>(u.size(), 65535));
+        uint16_t tl = static_cast<uint16_t>(std::min<size_t>(t.size(), 65535));
+
+        write_u16(out, ul);
+        if (ul) out.write(u.data(), ul);
+
+        write_u16(out, tl);
+        if (tl) out.write(t.data(), tl);
+    }
+    return static_cast<bool>(out);
+}
+
+bool load_docs(const std::string& path,
+               std::vector<std::string>& urls,
+               std::vector<std::string>& titles) {
+    DocStore docs;
+    if (!docs.open(path)) return false;
+    urls.resize(docs.size());
+    titles.resize(docs.size());
+    for (uint32_t i = 0; i < docs.size(); ++i) {
+        urls[i] = std::string(docs.url(i));
+        titles[i] = std::string(docs.title(i));
+    }
+    return true;
+}
+
+bool read_docs_count(const std::string& path, uint32_t& count) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    char magic[4];
+    in.read(magic, 4);
+    if (std::string(magic, 4) != "DOCS") return false;
+    uint32_t ver = read_u32(in);
+    if (ver != 1 && ver != 2) return false;
+    count = read_u32(in);
+    return static_cast<bool>(in);
+}
+
+static const size_t kDeletedHeader = 12;
+
+bool load_deleted(const std::string& dir, std::vector<uint8_t>& bits) {
+    bits.clear();
+    std::ifstream in(dir + "/deleted.bin", std::ios::binary);
+    if (!in) return false;
+
+    char magic[4];
+    in.read(magic, 4);
+    if (std::string(magic, 4) != "DELS" || read_u32(in) != 1) return false;
+    uint32_t n = read_u32(in);
+    bits.resize((n + 7) / 8);
+    if (!bits.empty()) in.read(reinterpret_cast<char*>(bits.data()), bits.size());
+    if (!in) bits.clear();
+    return static_cast<bool>(in);
+}
+
+bool save_deleted(const std::string& dir, uint32_t doc_count, const std::vector<uint8_t>& bits) {
+    std::string path = dir + "/deleted.bin";
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out) return false;
+        out.write("DELS", 4);
+        write_u32(out, 1);
+        write_u32(out, doc_count);
+        std::vector<uint8_t> b(bits);
+        b.resize((doc_count + 7) / 8, 0);
+        if (!b.empty()) out.write(reinterpret_cast<const char*>(b.data()), b.size());
+        if (!out) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool mark_deleted(const std::string& dir, uint32_t doc_count, uint32_t doc) {
+    if (doc >= doc_count) return false;
+    std::string path = dir + "/deleted.bin";
+
+    FILE* f = std::fopen(path.c_str(), "r+b");
+    if (!f) {
+        if (!save_deleted(dir, doc_count, {})) return false;
+        f = std::fopen(path.c_str(), "r+b");
+        if (!f) return false;
+    }
+
+    long pos = (long)(kDeletedHeader + (doc >> 3));
+    unsigned char byte = 0;
+    bool ok = std::fseek(f, pos, SEEK_SET) == 0 && std::fread(&byte, 1, 1, f) == 1;
+    if (ok) {
+        byte |= (unsigned char)(1u << (doc & 7));
+        ok = std::fseek(f, pos, SEEK_SET) == 0 && std::fwrite(&byte, 1, 1, f) == 1;
+    }
+    return std::fclose(f) == 0 && ok;
+}
+
+bool load_doc_lens(const std::string& dir, std::vector<uint32_t>& lens) {
+    lens.clear();
+    std::ifstream in(dir + "/doclens.bin", std::ios::binary);
+    if (!in) return false;
+
+    char magic[4];
+    in.read(magic, 4);
+    if (std::string(magic, 4) != "DLEN" || read_u32(in) != 1) return false;
+    lens.resize(read_u32(in));
+    if (!lens.empty()) in.read(reinterpret_cast<char*>(lens.data()), lens.size() * sizeof(uint32_t));
+    if (!in) lens.clear();
+    return static_cast<bool>(in);
+}
+
+bool save_doc_lens(const std::string& path, const std::vector<uint32_t>& lens) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out.write("DLEN", 4);
+    write_u32(out, 1);
+    write_u32(out, (uint32_t)lens.size());
+    if (!lens.empty()) out.write(reinterpret_cast<const char*>(lens.data()), lens.size() * sizeof(uint32_t));
+    return static_cast<bool>(out);
+}
+
+bool map_doc_lens(const std::string& dir, MappedFile& file, const uint32_t*& lens, uint32_t& count) {
+    if (!file.open(dir + "/doclens.bin") || !file.contains(0, 12)) return false;
+    const uint8_t* p = file.data();
+    if (std::memcmp(p, "DLEN", 4) != 0 || load_u32(p + 4) != 1) return false;
+    count = load_u32(p + 8);
+    if (!file.contains(12, (uint64_t)count * sizeof(uint32_t))) return false;
+    lens = reinterpret_cast<const uint32_t*>(p + 12);
+    return true;
+}
+
+bool IndexWriter::open(const std::string& postings_path, uint32_t format) {
+    postings_.open(postings_path, std::ios::binary);
+    lexicon_.clear();
+    offset_ = 0;
+    pos_offset_ = 0;
+    freq_offset_ = 0;
+    bm_offset_ = 0;
+    format_ = format;
+    flags_ = (format == kBidxVersionBlocked) ? kBidxFlagSkips : 0;
+    return static_cast<bool>(postings_);
+}
+
+bool IndexWriter::open_positions(const std::string& positions_path) {
+    positions_.open(positions_path, std::ios::binary);
+    format_ = kBidxVersionBlocked;
+    flags_ |= kBidxFlagPositions | kBidxFlagSkips;
+    return static_cast<bool>(positions_);
+}
+
+bool IndexWriter::open_bitmaps(const std::string& bitmaps_path) {
+    bitmaps_.open(bitmaps_path, std::ios::binary);
+    format_ = kBidxVersionBlocked;
+    flags_ |= kBidxFlagBitmaps | kBidxFlagSkips;
+    return static_cast<bool>(bitmaps_);
+}
+
+bool IndexWriter::open_freqs(const std::string& freqs_path, const std::vector<uint32_t>& doc_lens) {
+    freqs_.open(freqs_path, std::ios::binary);
+    doc_lens_ = &doc_lens;
+    format_ = kBidxVersionBlocked;
+    flags_ |= kBidxFlagFreqs | kBidxFlagSkips;
+    return static_cast<bool>(freqs_);
+}
+
+void IndexWriter::add(const std::string& term, const std::vector<uint32_t>& docs,
+                      const PositionLists* positions,
+                      const std::vector<uint32_t>* tfs) {
+    LexEntry e{term, offset_, (uint32_t)docs.size(), 0};
+
+    if (flags_ & kBidxFlagFreqs) {
+        freq_encoded_.clear();
+        freq_ends_.clear();
+        block_max_tf_.clear();
+        block_min_dl_.clear();
+        e.min_dl = UINT32_MAX;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            uint32_t tf = tfs ? (*tfs)[i] : 1;
+            uint32_t dl = docs[i] < doc_lens_->size() ? (*doc_lens_)[docs[i]] : 0;
+            if (i % kPostingsBlock == 0) {
+                block_max_tf_.push_back(0);
+                block_min_dl_.push_back(UINT32_MAX);
+            }
+            block_max_tf_.back() = std::max(block_max_tf_.back(), tf);
+            block_min_dl_.back() = std::min(block_min_dl_.back(), dl);
+            e.max_tf = std::max(e.max_tf, tf);
+            e.min_dl = std::min(e.min_dl, dl);
+        }
+        if (tfs) encode_freqs(*tfs, freq_encoded_, &freq_ends_);
+        else encode_freqs(std::vector<uint32_t>(docs.size(), 1), freq_encoded_, &freq_ends_);
+    }
+
+    if (format_ == kBidxVersionBlocked) {
+        encoded_.clear();
+        block_ends_.clear();
+        encode_postings(docs, encoded_, &block_ends_);
+        if (skip_table_bytes(e.df, flags_)) {
+            for (size_t b = 0; b < block_ends_.size(); ++b) {
+                size_t last = std::min(docs.size(), (b + 1) * kPostingsBlock) - 1;
+                write_u32(postings_, docs[last]);
+                write_u32(postings_, block_ends_[b]);
+                if (!(flags_ & kBidxFlagFreqs)) continue;
+                write_u32(postings_, freq_ends_[b]);
+                write_u32(postings_, block_max_tf_[b]);
+                write_u32(postings_, block_min_dl_[b]);
+            }
+        }
+        postings_.write(encoded_.data(), encoded_.size());
+        e.bytes = skip_table_bytes(e.df, flags_) + (uint32_t)encoded_.size();
+    } else {
+        e.bytes = (uint32_t)(docs.size() * sizeof(uint32_t));
+        postings_.write(reinterpret_cast<const char*>(docs.data()), e.bytes);
+    }
+    offset_ += e.bytes;
+
+    if (flags_ & kBidxFlagPositions) {
+        encoded_.clear();
+        if (positions) encode_positions(*positions, encoded_);
+        positions_.write(encoded_.data(), encoded_.size());
+        e.pos_offset = pos_offset_;
+        e.pos_bytes = (uint32_t)encoded_.size();
+        pos_offset_ += encoded_.size();
+    }
+
+    if (flags_ & kBidxFlagFreqs) {
+        freqs_.write(freq_encoded_.data(), freq_encoded_.size());
+        e.freq_offset = freq_offset_;
+        e.freq_bytes = (uint32_t)freq_encoded_.size();
+        freq_offset_ += freq_encoded_.size();
+    }
+
+    // Lists without a dense chunk get no record but still carry the running
+    // offset, which the front-coded lexicon stores once per block.
+    e.bm_offset = bm_offset_;
+    if ((flags_ & kBidxFlagBitmaps) && has_dense_chunk(docs)) {
+        encoded_.clear();
+        DocSet::encode(docs, encoded_);
+        bitmaps_.write(encoded_.data(), encoded_.size());
+        e.bm_bytes = (uint32_t)encoded_.size();
+        bm_offset_ += encoded_.size();
+    }
+    lexicon_.push_back(e);
+}
+
+static void append_u64(std::string& out, uint64_t x) {
+    out.append(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+// Writes the part of a front-coded terms.bin after the term count.
+static void write_front_coded(std::ofstream& terms, uint32_t flags,
+                              const std::vector<LexEntry>& lex) {
+    uint32_t blocks = (uint32_t)((lex.size() + kLexBlock - 1) / kLexBlock);
+    std::string body;
+    std::vector<uint64_t> offsets;
+    uint64_t base = 4 + 4 * sizeof(uint32_t) + sizeof(uint64_t);
+
+    for (size_t i = 0; i < lex.size(); ++i) {
+        const LexEntry& e = lex[i];
+        size_t shared = 0;
+        if (i % kLexBlock == 0) {
+            offsets.push_back(base + body.size());
+            append_u64(body, e.offset);
+            if (flags & kBidxFlagPositions) append_u64(body, e.pos_offset);
+            if (flags & kBidxFlagFreqs) append_u64(body, e.freq_offset);
+            if (flags & kBidxFlagBitmaps) append_u64(body, e.bm_offset);
+        } else {
+            const std::string& prev = lex[i - 1].term;
+            size_t n = std::min(prev.size(), e.term.size());
+            while (shared < n && prev[shared] == e.term[shared]) ++shared;
+        }
+        put_varint(body, (uint32_t)shared);
+        put_varint(body, (uint32_t)(e.term.size() - shared));
+        body.append(e.term, shared, std::string::npos);
+        put_varint(body, e.df);
+        put_varint(body, e.bytes);
+        if (flags & kBidxFlagPositions) put_varint(body, e.pos_bytes);
+        if (flags & kBidxFlagFreqs) {
+            put_varint(body, e.freq_bytes);
+            put_varint(body, e.max_tf);
+            put_varint(body, e.min_dl);
+        }
+        if (flags & kBidxFlagBitmaps) put_varint(body, e.bm_bytes);
+    }
+
+    uint64_t index = base + body.size();
+    offsets.push_back(index);
+    std::string firsts;
+    std::vector<uint32_t> first_ends(1, 0);
+    for (uint32_t b = 0; b < blocks; ++b) {
+        firsts += lex[(size_t)b * kLexBlock].term;
+        first_ends.push_back((uint32_t)firsts.size());
+    }
+
+    write_u32(terms, blocks);
+    write_u64(terms, index);
+    terms.write(body.data(), body.size());
+    for (uint64_t off : offsets) write_u64(terms, off);
+    for (uint32_t end : first_ends) write_u32(terms, end);
+    terms.write(firsts.data(), firsts.size());
+}
+
+bool IndexWriter::finish(const std::string& terms_path) {
+    postings_.close();
+    if (!postings_) return false;
+    if (flags_ & kBidxFlagPositions) {
+        positions_.close();
+        if (!positions_) return false;
+    }
+    if (flags_ & kBidxFlagFreqs) {
+        freqs_.close();
+        if (!freqs_) return false;
+    }
+    if (flags_ & kBidxFlagBitmaps) {
+        bitmaps_.close();
+        if (!bitmaps_) return false;
+    }
+
+    std::ofstream terms(terms_path, std::ios::binary);
+    if (!terms) return false;
+
+    terms.write("BIDX", 4);
+    write_u32(terms, format_);
+    if (format_ == kBidxVersionBlocked) {
+        flags_ |= kBidxFlagFrontCoded | kBidxFlagBlockTable;
+        write_u32(terms, flags_);
+        write_u32(terms, (uint32_t)lexicon_.size());
+        write_front_coded(terms, flags_, lexicon_);
+        return static_cast<bool>(terms);
+    }
+    write_u32(terms, (uint32_t)lexicon_.size());
+
+    for (const auto& e : lexicon_) {
+        uint16_t len = static_cast<uint16_t>(std::min<size_t>(e.term.size(), 65535));
+        write_u16(terms, len);
+        if (len) terms.write(e.term.data(), len);
+        write_u64(terms, e.offset);
+        write_u32(terms, e.df);
+    }
+
+    return static_cast<bool>(terms);
+}
+
+bool load_manifest(const std::string& dir, std::vector<SegmentInfo>& segs, const char* name) {
+    segs.clear();
+    std::ifstream in(dir + "/" + name);
+    if (!in) return false;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        size_t t1 = line.find('\t');
+        size_t t2 = (t1 == std::string::npos) ? t1 : line.find('\t', t1 + 1);
+        if (t2 == std::string::npos) return false;
+        SegmentInfo s;
+        s.name = line.substr(0, t1);
+        try {
+            s.doc_base = (uint32_t)std::stoul(line.substr(t1 + 1, t2 - t1 - 1));
+            s.doc_count = (uint32_t)std::stoul(line.substr(t2 + 1));
+        } catch (...) {
+            return false;
+        }
+        segs.push_back(s);
+    }
+    return true;
+}
+
+bool save_manifest(const std::string& dir, const std::vector<SegmentInfo>& segs, const char* name) {
+    std::string path = dir + "/" + name;
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp);
+        if (!out) return false;
+        for (const auto& s : segs) {
+            out << s.name << "\t" << s.doc_base << "\t" << s.doc_count << "\n";
+        }
+        if (!out) return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool list_segments(const std::string& dir, std::vector<SegmentInfo>& segs) {
+    if (load_manifest(dir, segs)) return true;
+    uint32_t n;
+    if (!read_docs_count(dir + "/docs.bin", n)) return false;
+    segs.push_back({".", 0, n});
+    return true;
+}
+
+std::string segment_dir(const std::string& dir, const SegmentInfo& s) {
+    return s.name == "." ? dir : dir + "/" + s.name;
+}
+
+bool publish_segment_files(const std::string& dir) {
+    static const char* const kFiles[] = {"postings.bin", "positions.bin", "freqs.bin", "bitmaps.bin",
+                                         "doclens.bin", "docs.bin", "terms.bin"};
+    for (const char* name : kFiles) {
+        std::string path = dir + "/" + name;
+        std::string tmp = path + ".tmp";
+        if (std::rename(tmp.c_str(), path.c_str()) == 0) continue;
+        if (errno != ENOENT) return false;
+        std::remove(path.c_str());
+    }
+    return true;
+}
@@ -0,0 +1,256 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped_file.h"
+#include "postings_codec.h"
+
+void write_u16(std::ofstream& out, uint16_t x);
+void write_u32(std::ofstream& out, uint32_t x);
+void write_u64(std::ofstream& out, uint64_t x);
+
+uint16_t read_u16(std::ifstream& in);
+uint32_t read_u32(std::ifstream& in);
+uint64_t read_u64(std::ifstream& in);
+
+struct LexEntry {
+  std::string term;
+  uint64_t offset;
+  uint32_t df;
+  uint32_t bytes;
+  uint64_t pos_offset = 0;
+  uint32_t pos_bytes = 0;
+  uint64_t freq_offset = 0;
+  uint32_t freq_bytes = 0;
+  uint32_t max_tf = 0;
+  uint32_t min_dl = 0;
+  uint64_t bm_offset = 0;
+  uint32_t bm_bytes = 0;
+};
+
+// Front-coded terms.bin (v2, kBidxFlagFrontCoded): header "BIDX", u32 version,
+// u32 flags, u32 term count, u32 block count, u64 offset of the block index.
+// Each block of kLexBlock terms starts with the u64 postings (then positions,
+// freqs, bitmaps) offset of its first term; each term is varint shared prefix
+// length, varint suffix length, suffix, varint df, varint byte length, then
+// varint positions bytes, varint freqs bytes, max tf, min dl and varint
+// bitmaps bytes if present. Offsets of later terms follow from the lengths
+// before them. The block index (kBidxFlagBlockTable) is u64 offset of every
+// block plus the index offset, u32 end of every block's first term plus a
+// leading 0, then the first terms back to back.
+constexpr uint32_t kLexBlock = 32;
+
+bool load_terms(const std::string& path, std::vector<LexEntry>& lex,
+                uint32_t& version, uint32_t& flags);
+bool read_terms_header(const std::string& path, uint32_t& version, uint32_t& flags);
+int lex_find(const std::vector<LexEntry>& lex, const std::string& term);
+void read_postings(std::ifstream& in, uint32_t version, uint32_t flags, const LexEntry& e,
+                   std::vector<uint32_t>& out);
+bool read_positions(std::ifstream& in, const LexEntry& e, PositionLists& out);
+void read_postings(const MappedFile& postings, uint32_t version, uint32_t flags,
+                   const LexEntry& e, std::vector<uint32_t>& out);
+bool read_freqs(std::ifstream& in, const LexEntry& e, std::vector<uint32_t>& out);
+
+// Term lookups on a mapped terms.bin. For a front-coded file open() reads
+// only the header and lookups binary search the block table and decode one
+// block in place; v1 and unblocked layouts are loaded whole. Lookups do not
+// modify the lexicon and may run concurrently.
+class Lexicon {
+ public:
+  bool open(const std::string& path);
+  uint32_t version() const { return version_; }
+  uint32_t flags() const { return flags_; }
+  size_t size() const { return size_; }
+
+  bool find(const std::string& term, LexEntry& out) const;
+  // Entries whose term starts with prefix, in term order: one seek to the
+  // first block that can hold them, then sequential block reads.
+  bool find_prefix(const std::string& prefix, std::vector<LexEntry>& out) const;
+  bool read_all(std::vector<LexEntry>& out) const;
+
+ private:
+  uint64_t block_offset(size_t b) const;
+  std::string_view first_term(size_t b) const;
+  size_t find_block(std::string_view term, bool strict) const;
+  bool read_block(size_t b, std::vector<LexEntry>& out) const;
+
+  MappedFile file_;
+  uint32_t version_ = 0;
+  uint32_t flags_ = 0;
+  size_t size_ = 0;
+  uint32_t blocks_ = 0;
+  uint64_t index_ = 0;
+  const uint8_t* table_ = nullptr;
+  const uint8_t* terms_ = nullptr;
+  std::vector<LexEntry> all_;
+};
+
+// Reads one posting list from mapped postings.bin a block at a time. With
+// skip entries seek() looks the target's block up in the skip table and
+// decodes only that block; lists without them form a single block, decoded
+// on open (v2) or used in place (v1). Block b's bounds (last doc, max tf, min
+// doc length) are available without decoding.
+class PostingCursor {
+ public:
+  static constexpr uint32_t kNoBlock = 0xFFFFFFFFu;
+
+  bool open(const MappedFile& postings, uint32_t version, uint32_t flags,
+            const LexEntry& e, const MappedFile* freqs = nullptr);
+  bool done() const { return idx_ >= df_; }
+  uint32_t doc() const { return docs_[idx_ - first_]; }
+  uint32_t index() const { return idx_; }
+  uint32_t tf();
+  void next();
+  void seek(uint32_t target);
+
+  uint32_t find_block(uint32_t target) const;
+  uint32_t block_last(uint32_t b) const { return skips_ ? skip(b, 0) : last_; }
+  uint32_t block_max_tf(uint32_t b) const { return words_ == 5 ? skip(b, 3) : entry_.max_tf; }
+  uint32_t block_min_dl(uint32_t b) const { return words_ == 5 ? skip(b, 4) : entry_.min_dl; }
+  bool ok() const { return ok_; }
+
+ private:
+  uint32_t skip(uint32_t b, uint32_t w) const { return load_u32(skips_ + (b * words_ + w) * 4); }
+  bool load(uint32_t b);
+  void fail() { ok_ = false; idx_ = df_; }
+
+  const MappedFile* freqs_ = nullptr;
+  LexEntry entry_;
+  const uint8_t* skips_ = nullptr;
+  const uint8_t* data_ = nullptr;
+  const uint8_t* end_ = nullptr;
+  uint32_t words_ = 0;
+  uint32_t blocks_ = 0;
+  uint32_t last_ = 0;
+  uint32_t df_ = 0;
+  uint32_t idx_ = 0;
+  uint32_t first_ = 0;
+  uint32_t block_ = 0;
+  uint32_t count_ = 0;
+  bool tfs_loaded_ = false;
+  bool ok_ = true;
+  const uint32_t* docs_ = nullptr;
+  std::vector<uint32_t> owned_;
+  std::vector<uint32_t> tfs_;
+};
+
+// Random access to the positions of one term's postings in mapped
+// positions.bin: decodes only the blocks that hold the requested postings.
+class PositionCursor {
+ public:
+  bool open(const MappedFile& positions, const LexEntry& e);
+  bool get(uint32_t idx, std::vector<uint32_t>& out);
+
+ private:
+  const uint8_t* blocks_ = nullptr;
+  const uint8_t* records_ = nullptr;
+  uint32_t nblocks_ = 0;
+  uint32_t records_bytes_ = 0;
+};
+
+// docs.bin: "DOCS", u32 version, u32 doc_count, then one record per document:
+// u16 url length, url, u16 title length, title. Version 2 puts the u64 file
+// offset of every record plus the end of the last one before the records.
+class DocStore {
+ public:
+  bool open(const std::string& path);
+  uint32_t size() const { return count_; }
+  std::string_view url(uint32_t d) const { return field(d, 0); }
+  std::string_view title(uint32_t d) const { return field(d, 1); }
+
+ private:
+  uint64_t record(uint32_t d) const;
+  std::string_view field(uint32_t d, int k) const;
+
+  MappedFile file_;
+  uint32_t count_ = 0;
+  const uint8_t* offsets_ = nullptr;
+  std::vector<uint64_t> scanned_;
+};
+
+bool save_docs(const std::string& path,
+               const std::vector<std::string>& urls,
+               const std::vector<std::string>& titles);
+bool load_docs(const std::string& path,
+               std::vector<std::string>& urls,
+               std::vector<std::string>& titles);
+bool read_docs_count(const std::string& path, uint32_t& count);
+
+// deleted.bin: "DELS", u32 version = 1, u32 doc_count, then ceil(doc_count / 8)
+// bitmap bytes; bit d set means local doc d is deleted. Updated in place.
+bool load_deleted(const std::string& dir, std::vector<uint8_t>& bits);
+bool mark_deleted(const std::string& dir, uint32_t doc_count, uint32_t doc);
+bool save_deleted(const std::string& dir, uint32_t doc_count, const std::vector<uint8_t>& bits);
+
+// doclens.bin: "DLEN", u32 version = 1, u32 doc_count, then u32 token count
+// of every document.
+bool load_doc_lens(const std::string& dir, std::vector<uint32_t>& lens);
+bool save_doc_lens(const std::string& path, const std::vector<uint32_t>& lens);
+// Maps doclens.bin; lens points into the mapping.
+bool map_doc_lens(const std::string& dir, MappedFile& file, const uint32_t*& lens, uint32_t& count);
+
+inline bool is_deleted(const std::vector<uint8_t>& bits, uint32_t d) {
+  return (d >> 3) < bits.size() && ((bits[d >> 3] >> (d & 7)) & 1);
+}
+
+// Writes terms.bin/postings.bin from posting lists added in term order.
+class IndexWriter {
+ public:
+  bool open(const std::string& postings_path, uint32_t format);
+  bool open_positions(const std::string& positions_path);
+  bool open_freqs(const std::string& freqs_path, const std::vector<uint32_t>& doc_lens);
+  // Also writes lists with a chunk denser than kArrayMax as DocSet records.
+  bool open_bitmaps(const std::string& bitmaps_path);
+  void add(const std::string& term, const std::vector<uint32_t>& docs,
+           const PositionLists* positions = nullptr,
+           const std::vector<uint32_t>* tfs = nullptr);
+  bool finish(const std::string& terms_path);
+
+ private:
+  std::ofstream postings_;
+  std::ofstream positions_;
+  std::ofstream freqs_;
+  std::ofstream bitmaps_;
+  const std::vector<uint32_t>* doc_lens_ = nullptr;
+  std::vector<LexEntry> lexicon_;
+  std::string encoded_;
+  std::string freq_encoded_;
+  std::vector<uint32_t> block_ends_;
+  std::vector<uint32_t> freq_ends_;
+  std::vector<uint32_t> block_max_tf_;
+  std::vector<uint32_t> block_min_dl_;
+  uint64_t offset_ = 0;
+  uint64_t pos_offset_ = 0;
+  uint64_t freq_offset_ = 0;
+  uint64_t bm_offset_ = 0;
+  uint32_t format_ = 1;
+  uint32_t flags_ = 0;
+};
+
+// segments.txt lists the immutable segments of an index directory, one per
+// line: "<subdir>\t<doc_base>\t<doc_count>", ordered by doc_base. The subdir
+// "." is the index built in the directory itself. Without a manifest the
+// directory is a single segment. A sharded index lists its shard_NNN
+// subdirectories in shards.txt in the same format instead.
+struct SegmentInfo {
+  std::string name;
+  uint32_t doc_base;
+  uint32_t doc_count;
+};
+
+bool load_manifest(const std::string& dir, std::vector<SegmentInfo>& segs,
+                   const char* name = "segments.txt");
+bool save_manifest(const std::string& dir, const std::vector<SegmentInfo>& segs,
+                   const char* name = "segments.txt");
+bool list_segments(const std::string& dir, std::vector<SegmentInfo>& segs);
+std::string segment_dir(const std::string& dir, const SegmentInfo& s);
+
+// A build writes the segment files as "<file>.tmp" and publishes them here
+// once all are complete: each is renamed over the old file, terms.bin last,
+// and old files the build did not write again are removed. A server that has
+// the old files mapped keeps its mappings, and a lexicon it opens is never
+// newer than the files it points into.
+bool publish_segment_files(const std::string& dir);
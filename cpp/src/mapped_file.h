@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Read-only mapping of a whole file. An empty file maps to a null view.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(MappedFile&& o) noexcept;
+  MappedFile& operator=(MappedFile&& o) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const std::string& path);
+  void close();
+  bool is_open() const { return open_; }
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  // True if [offset, offset + n) lies inside the file.
+  bool contains(uint64_t offset, uint64_t n) const {
+    return offset <= size_ && n <= size_ - offset;
+  }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  bool open_ = false;
+};
+
+// Unaligned little-endian loads from mapped bytes.
+inline uint16_t load_u16(const uint8_t* p) {
+  uint16_t x;
+  std::memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+inline uint32_t load_u32(const uint8_t* p) {
+  uint32_t x;
+  std::memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+inline uint64_t load_u64(const uint8_t* p) {
+  uint64_t x;
+  std::memcpy(&x, p, sizeof(x));
+  return x;
+}
@@ -0,0 +1,100 @@
+#include "fs_utils.h"
+#include "index_io.h"
+#include "postings_codec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct BenchEntry {
+    uint64_t offset;
+    uint32_t df;
+    uint32_t bytes;
+};
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: postings_bench <index_dir> [--rounds N]\n";
+        return 1;
+    }
+    std::string dir = argv[1];
+    int rounds = 5;
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--rounds" && i + 1 < argc) rounds = std::max(1, std::stoi(argv[++i]));
+    }
+
+    uint32_t version = 0, flags = 0;
+    std::vector<LexEntry> lex;
+    if (!load_terms(dir + "/terms.bin", lex, version, flags)) return 2;
+    std::string postings;
+    if (!read_file_utf8(dir + "/postings.bin", postings)) return 3;
+
+    std::vector<std::vector<uint32_t>> lists(lex.size());
+    for (size_t i = 0; i < lex.size(); ++i) {
+        const auto& e = lex[i];
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(postings.data()) + e.offset;
+        if (version == kBidxVersionBlocked) {
+            uint32_t table = skip_table_bytes(e.df, flags);
+            if (table > e.bytes || !decode_postings(p + table, e.bytes - table, e.df, lists[i])) return 5;
+        } else {
+            lists[i].resize(e.df);
+            std::memcpy(lists[i].data(), p, e.bytes);
+        }
+    }
+
+    std::string raw, packed;
+    std::vector<BenchEntry> raw_lex(lex.size()), packed_lex(lex.size());
+    uint64_t total_docs = 0, skip_bytes = 0;
+    for (size_t i = 0; i < lists.size(); ++i) {
+        const auto& v = lists[i];
+        raw_lex[i] = {raw.size(), (uint32_t)v.size(), (uint32_t)(v.size() * sizeof(uint32_t))};
+        raw.append(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(uint32_t));
+        size_t before = packed.size();
+        encode_postings(v, packed);
+        packed_lex[i] = {before, (uint32_t)v.size(), (uint32_t)(packed.size() - before)};
+        total_docs += v.size();
+        skip_bytes += skip_table_bytes((uint32_t)v.size(), kBidxFlagSkips);
+    }
+
+    std::vector<uint32_t> buf;
+    uint64_t checksum = 0;
+    auto time_decode = [&](bool blocked) {
+        const auto& L = blocked ? packed_lex : raw_lex;
+        const std::string& src = blocked ? packed : raw;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            for (const auto& e : L) {
+                const uint8_t* p = reinterpret_cast<const uint8_t*>(src.data()) + e.offset;
+                if (blocked) {
+                    decode_postings(p, e.bytes, e.df, buf);
+                } else {
+                    buf.resize(e.df);
+                    if (e.df) std::memcpy(buf.data(), p, e.bytes);
+                }
+                if (!buf.empty()) checksum += buf.back();
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(t1 - t0).count();
+    };
+
+    double t_raw = time_decode(false);
+    double t_packed = time_decode(true);
+    double docs = (double)total_docs * rounds;
+
+    std::cout << "terms=" << lex.size() << "\n";
+    std::cout << "postings=" << total_docs << "\n";
+    std::cout << "v1_bytes=" << raw.size() << "\n";
+    std::cout << "v2_bytes=" << packed.size() << "\n";
+    std::cout << "v2_skip_bytes=" << skip_bytes << "\n";
+    std::cout << "v2_bits_per_doc=" << (total_docs ? 8.0 * packed.size() / total_docs : 0.0) << "\n";
+    std::cout << "v1_decode_mdocs_per_sec=" << (t_raw > 0 ? docs / t_raw / 1e6 : 0.0) << "\n";
+    std::cout << "v2_decode_mdocs_per_sec=" << (t_packed > 0 ? docs / t_packed / 1e6 : 0.0) << "\n";
+    std::cout << "checksum=" << checksum << "\n";
+    return 0;
+}
@@ -0,0 +1,254 @@
+#include "postings_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+static constexpr uint32_t kLanes = 4;
+static constexpr uint32_t kPerLane = kPostingsBlock / kLanes;
+
+void put_varint(std::string& out, uint32_t x) {
+    while (x >= 0x80) {
+        out.push_back(static_cast<char>((x & 0x7F) | 0x80));
+        x >>= 7;
+    }
+    out.push_back(static_cast<char>(x));
+}
+
+bool get_varint(const uint8_t*& p, const uint8_t* end, uint32_t& x) {
+    x = 0;
+    for (int shift = 0; shift <= 28; shift += 7) {
+        if (p >= end) return false;
+        uint8_t b = *p++;
+        x |= static_cast<uint32_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint32_t bit_width(uint32_t x) {
+    uint32_t b = 0;
+    while (x) { ++b; x >>= 1; }
+    return b;
+}
+
+static void pack_block(const uint32_t* gaps, uint32_t b, std::string& out) {
+    uint32_t words[kPostingsBlock] = {0};
+    for (uint32_t lane = 0; lane < kLanes; ++lane) {
+        uint64_t acc = 0;
+        uint32_t filled = 0;
+        uint32_t w = 0;
+        for (uint32_t k = 0; k < kPerLane; ++k) {
+            acc |= static_cast<uint64_t>(gaps[k * kLanes + lane]) << filled;
+            filled += b;
+            if (filled >= 32) {
+                words[w++ * kLanes + lane] = static_cast<uint32_t>(acc);
+                acc >>= 32;
+                filled -= 32;
+            }
+        }
+    }
+    out.append(reinterpret_cast<const char*>(words), b * kLanes * sizeof(uint32_t));
+}
+
+static void unpack_block(const uint8_t* p, uint32_t b, uint32_t* gaps) {
+    if (b == 0) {
+        std::memset(gaps, 0, kPostingsBlock * sizeof(uint32_t));
+        return;
+    }
+    uint32_t words[kPostingsBlock];
+    std::memcpy(words, p, b * kLanes * sizeof(uint32_t));
+    const uint64_t mask = (b == 32) ? 0xFFFFFFFFull : ((1ull << b) - 1);
+    uint64_t acc[kLanes] = {0};
+    uint32_t filled = 0;
+    uint32_t w = 0;
+    for (uint32_t k = 0; k < kPerLane; ++k) {
+        bool load = filled < b;
+        for (uint32_t lane = 0; lane < kLanes; ++lane) {
+            if (load) acc[lane] |= static_cast<uint64_t>(words[w * kLanes + lane]) << filled;
+            gaps[k * kLanes + lane] = static_cast<uint32_t>(acc[lane] & mask);
+            acc[lane] >>= b;
+        }
+        if (load) { ++w; filled += 32; }
+        filled -= b;
+    }
+}
+
+void encode_postings(const std::vector<uint32_t>& docs, std::string& out,
+                     std::vector<uint32_t>* block_ends) {
+    size_t start = out.size();
+    uint32_t next = 0;
+    size_t i = 0;
+    uint32_t gaps[kPostingsBlock];
+
+    for (; i + kPostingsBlock <= docs.size(); i += kPostingsBlock) {
+        uint32_t all = 0;
+        for (uint32_t k = 0; k < kPostingsBlock; ++k) {
+            gaps[k] = docs[i + k] - next;
+            next = docs[i + k] + 1;
+            all |= gaps[k];
+        }
+        uint32_t b = bit_width(all);
+        out.push_back(static_cast<char>(b));
+        pack_block(gaps, b, out);
+        if (block_ends) block_ends->push_back((uint32_t)(out.size() - start));
+    }
+
+    for (; i < docs.size(); ++i) {
+        put_varint(out, docs[i] - next);
+        next = docs[i] + 1;
+    }
+    if (block_ends && docs.size() % kPostingsBlock) block_ends->push_back((uint32_t)(out.size() - start));
+}
+
+bool decode_postings_block(const uint8_t*& p, const uint8_t* end, uint32_t count,
+                           uint32_t& next, uint32_t* out) {
+    if (count < kPostingsBlock) {
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t gap;
+            if (!get_varint(p, end, gap)) return false;
+            next += gap;
+            out[i] = next++;
+        }
+        return true;
+    }
+
+    if (p >= end) return false;
+    uint32_t b = *p++;
+    size_t bytes = b * kLanes * sizeof(uint32_t);
+    if (b > 32 || static_cast<size_t>(end - p) < bytes) return false;
+    unpack_block(p, b, out);
+    p += bytes;
+    for (uint32_t k = 0; k < kPostingsBlock; ++k) {
+        next += out[k];
+        out[k] = next++;
+    }
+    return true;
+}
+
+bool decode_postings(const uint8_t* p, size_t n, uint32_t count, std::vector<uint32_t>& out) {
+    out.resize(count);
+    const uint8_t* end = p + n;
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < count; i += kPostingsBlock) {
+        uint32_t c = std::min(kPostingsBlock, count - i);
+        if (!decode_postings_block(p, end, c, next, out.data() + i)) return false;
+    }
+    return true;
+}
+
+void encode_freqs(const std::vector<uint32_t>& tfs, std::string& out,
+                  std::vector<uint32_t>* block_ends) {
+    size_t start = out.size();
+    size_t i = 0;
+    uint32_t vals[kPostingsBlock];
+
+    for (; i + kPostingsBlock <= tfs.size(); i += kPostingsBlock) {
+        uint32_t all = 0;
+        for (uint32_t k = 0; k < kPostingsBlock; ++k) {
+            vals[k] = tfs[i + k] - 1;
+            all |= vals[k];
+        }
+        uint32_t b = bit_width(all);
+        out.push_back(static_cast<char>(b));
+        pack_block(vals, b, out);
+        if (block_ends) block_ends->push_back((uint32_t)(out.size() - start));
+    }
+
+    for (; i < tfs.size(); ++i) put_varint(out, tfs[i] - 1);
+    if (block_ends && tfs.size() % kPostingsBlock) block_ends->push_back((uint32_t)(out.size() - start));
+}
+
+bool decode_freqs_block(const uint8_t*& p, const uint8_t* end, uint32_t count, uint32_t* out) {
+    if (count < kPostingsBlock) {
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t v;
+            if (!get_varint(p, end, v)) return false;
+            out[i] = v + 1;
+        }
+        return true;
+    }
+
+    if (p >= end) return false;
+    uint32_t b = *p++;
+    size_t bytes = b * kLanes * sizeof(uint32_t);
+    if (b > 32 || static_cast<size_t>(end - p) < bytes) return false;
+    unpack_block(p, b, out);
+    p += bytes;
+    for (uint32_t k = 0; k < kPostingsBlock; ++k) out[k] += 1;
+    return true;
+}
+
+bool decode_freqs(const uint8_t* p, size_t n, uint32_t count, std::vector<uint32_t>& out) {
+    out.resize(count);
+    const uint8_t* end = p + n;
+    for (uint32_t i = 0; i < count; i += kPostingsBlock) {
+        uint32_t c = std::min(kPostingsBlock, count - i);
+        if (!decode_freqs_block(p, end, c, out.data() + i)) return false;
+    }
+    return true;
+}
+
+void encode_positions(const PositionLists& pl, std::string& out) {
+    uint32_t count = (uint32_t)pl.ends.size();
+    uint32_t blocks = (count + kPostingsBlock - 1) / kPostingsBlock;
+    size_t table = out.size();
+    out.append(blocks * sizeof(uint32_t), '\0');
+    size_t records = out.size();
+
+    std::string rec;
+    uint32_t begin = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i % kPostingsBlock == 0) {
+            uint32_t off = (uint32_t)(out.size() - records);
+            std::memcpy(&out[table + (i / kPostingsBlock) * sizeof(uint32_t)], &off, sizeof(off));
+        }
+        rec.clear();
+        put_varint(rec, pl.ends[i] - begin);
+        uint32_t prev = 0;
+        for (uint32_t k = begin; k < pl.ends[i]; ++k) {
+            put_varint(rec, pl.pos[k] - prev);
+            prev = pl.pos[k];
+        }
+        put_varint(out, (uint32_t)rec.size());
+        out += rec;
+        begin = pl.ends[i];
+    }
+}
+
+bool decode_position_record(const uint8_t*& p, const uint8_t* end, std::vector<uint32_t>* out) {
+    uint32_t len;
+    if (!get_varint(p, end, len) || (size_t)(end - p) < len) return false;
+    const uint8_t* rec_end = p + len;
+    if (!out) {
+        p = rec_end;
+        return true;
+    }
+    uint32_t n;
+    if (!get_varint(p, rec_end, n)) return false;
+    out->clear();
+    uint32_t cur = 0;
+    for (uint32_t k = 0; k < n; ++k) {
+        uint32_t gap;
+        if (!get_varint(p, rec_end, gap)) return false;
+        cur += gap;
+        out->push_back(cur);
+    }
+    p = rec_end;
+    return true;
+}
+
+bool decode_positions(const uint8_t* p, size_t n, uint32_t count, PositionLists& out) {
+    out.clear();
+    size_t table = ((count + kPostingsBlock - 1) / kPostingsBlock) * sizeof(uint32_t);
+    if (n < table) return false;
+    const uint8_t* end = p + n;
+    p += table;
+
+    std::vector<uint32_t> one;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!decode_position_record(p, end, &one)) return false;
+        out.pos.insert(out.pos.end(), one.begin(), one.end());
+        out.ends.push_back((uint32_t)out.pos.size());
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// BIDX v2 posting lists: doc ids are stored as d-gaps (doc - prev - 1).
+// Every full block of kPostingsBlock gaps is bit-packed with one width byte,
+// interleaved over 4 lanes of 32-bit words so the unpack loop vectorizes;
+// the tail (< kPostingsBlock gaps) is varint-coded.
+constexpr uint32_t kPostingsBlock = 128;
+
+// terms.bin v2: "BIDX", u32 version = 2, u32 flags, u32 term count; each entry
+// is u16 len, term, u64 offset, u32 df, u32 byte length of the posting list.
+constexpr uint32_t kBidxVersionRaw = 1;
+constexpr uint32_t kBidxVersionBlocked = 2;
+
+// v2 flags. kBidxFlagPositions: positions.bin is present and every entry
+// additionally stores u64 positions offset and u32 positions byte length.
+constexpr uint32_t kBidxFlagPositions = 1;
+// kBidxFlagFreqs: freqs.bin and doclens.bin are present and every entry
+// additionally stores u64 freqs offset, u32 freqs byte length, u32 max tf and
+// u32 min length of a document containing the term (BM25 upper bound).
+constexpr uint32_t kBidxFlagFreqs = 2;
+// kBidxFlagSkips: a posting list longer than one block starts with a skip
+// entry per block: u32 last doc id and u32 end of the block's bytes (relative
+// to the end of the table); with kBidxFlagFreqs also u32 end of the block's tf
+// bytes, u32 max tf and u32 min document length in the block.
+constexpr uint32_t kBidxFlagSkips = 4;
+
+// kBidxFlagFrontCoded: terms.bin stores the lexicon in front-coded blocks
+// with a block index (see index_io.h) instead of one fixed entry per term.
+constexpr uint32_t kBidxFlagFrontCoded = 8;
+// kBidxFlagBlockTable: the front-coded block index is a fixed-width table
+// that is searched in place instead of being loaded.
+constexpr uint32_t kBidxFlagBlockTable = 16;
+// kBidxFlagBitmaps: bitmaps.bin is present and every entry additionally
+// stores u64 offset and u32 byte length of the term's chunked array/bitmap
+// record (see doc_set.h); the length is 0 for terms without a dense chunk.
+constexpr uint32_t kBidxFlagBitmaps = 32;
+
+inline uint32_t skip_entry_words(uint32_t flags) { return (flags & kBidxFlagFreqs) ? 5 : 2; }
+
+inline uint32_t skip_table_bytes(uint32_t df, uint32_t flags) {
+  if (!(flags & kBidxFlagSkips) || df <= kPostingsBlock) return 0;
+  return (df + kPostingsBlock - 1) / kPostingsBlock * skip_entry_words(flags) * 4;
+}
+
+// block_ends, if given, receives the end offset of every block (the last
+// one may be a partial tail) relative to the start of this list.
+void encode_postings(const std::vector<uint32_t>& docs, std::string& out,
+                     std::vector<uint32_t>* block_ends = nullptr);
+bool decode_postings(const uint8_t* p, size_t n, uint32_t count, std::vector<uint32_t>& out);
+// Decodes one block of count <= kPostingsBlock doc ids: a full block is
+// bit-packed, a shorter one is the varint tail. next is the doc id the first
+// gap counts from and is advanced past the block.
+bool decode_postings_block(const uint8_t*& p, const uint8_t* end, uint32_t count,
+                           uint32_t& next, uint32_t* out);
+
+// Term frequencies of one posting list, stored as tf - 1 in the same block
+// layout as the doc ids (without the d-gap transform).
+void encode_freqs(const std::vector<uint32_t>& tfs, std::string& out,
+                  std::vector<uint32_t>* block_ends = nullptr);
+bool decode_freqs(const uint8_t* p, size_t n, uint32_t count, std::vector<uint32_t>& out);
+bool decode_freqs_block(const uint8_t*& p, const uint8_t* end, uint32_t count, uint32_t* out);
+
+// Positions of posting i are pos[ends[i - 1], ends[i]), ascending.
+struct PositionLists {
+  std::vector<uint32_t> ends;
+  std::vector<uint32_t> pos;
+
+  void clear() { ends.clear(); pos.clear(); }
+};
+
+// Positions region of one term: u32 offset of every kPostingsBlock-th record
+// (relative to the end of this table), then one record per posting:
+// varint record length, varint count, varint position gaps.
+void encode_positions(const PositionLists& pl, std::string& out);
+bool decode_positions(const uint8_t* p, size_t n, uint32_t count, PositionLists& out);
+bool decode_position_record(const uint8_t*& p, const uint8_t* end, std::vector<uint32_t>* out);
+
+void put_varint(std::string& out, uint32_t x);
+bool get_varint(const uint8_t*& p, const uint8_t* end, uint32_t& x);
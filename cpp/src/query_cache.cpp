@@ -0,0 +1,54 @@
+#include "query_cache.h"
+
+size_t QueryCache::entry_bytes(const std::string& key, const DocList& docs) {
+    return 2 * key.size() + docs->capacity() * sizeof(uint32_t) + 128;
+}
+
+DocList QueryCache::get(const std::string& key) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+        ++stats_.misses;
+        return nullptr;
+    }
+    ++stats_.hits;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->docs;
+}
+
+void QueryCache::put(const std::string& key, DocList docs) {
+    size_t bytes = entry_bytes(key, docs);
+    if (bytes > budget_) return;
+
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+        stats_.bytes -= it->second->bytes;
+        lru_.erase(it->second);
+        map_.erase(it);
+    }
+    while (!lru_.empty() && stats_.bytes + bytes > budget_) {
+        stats_.bytes -= lru_.back().bytes;
+        map_.erase(lru_.back().key);
+        lru_.pop_back();
+        ++stats_.evictions;
+    }
+    lru_.push_front({key, std::move(docs), bytes});
+    map_[key] = lru_.begin();
+    stats_.bytes += bytes;
+    ++stats_.inserts;
+}
+
+void QueryCache::clear() {
+    std::lock_guard<std::mutex> lk(mu_);
+    lru_.clear();
+    map_.clear();
+    stats_.bytes = 0;
+}
+
+CacheStats QueryCache::stats() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    CacheStats s = stats_;
+    s.entries = lru_.size();
+    return s;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using DocList = std::shared_ptr<const std::vector<uint32_t>>;
+
+struct CacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t inserts = 0;
+  uint64_t evictions = 0;
+  size_t entries = 0;
+  size_t bytes = 0;
+};
+
+// LRU cache of evaluated doc id lists keyed by normalized subexpression,
+// bounded by the bytes the lists and keys take. Safe to share between
+// threads; cached lists are immutable and stay valid while a caller holds
+// them, even after eviction.
+class QueryCache {
+ public:
+  explicit QueryCache(size_t budget_bytes) : budget_(budget_bytes) {}
+
+  DocList get(const std::string& key);
+  void put(const std::string& key, DocList docs);
+  CacheStats stats() const;
+  // Drops every entry; the hit, miss and eviction counters keep counting.
+  void clear();
+
+ private:
+  struct Entry {
+    std::string key;
+    DocList docs;
+    size_t bytes;
+  };
+
+  static size_t entry_bytes(const std::string& key, const DocList& docs);
+
+  mutable std::mutex mu_;
+  size_t budget_;
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> map_;
+  CacheStats stats_;
+};
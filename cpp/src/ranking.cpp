@@ -0,0 +1,120 @@
+#include "ranking.h"
+
+#include <algorithm>
+#include <cmath>
+
+double Bm25::idf(uint64_t doc_count, uint64_t df) {
+    double n = (double)doc_count;
+    double f = (double)std::min(df, doc_count);
+    return std::log(1.0 + (n - f + 0.5) / (f + 0.5));
+}
+
+double Bm25::tf_part(uint32_t tf, uint32_t dl) const {
+    double norm = k1 * (1.0 - b + b * (double)dl / avgdl);
+    return (double)tf * (k1 + 1.0) / ((double)tf + norm);
+}
+
+static size_t gallop(const std::vector<uint32_t>& v, size_t from, uint32_t target) {
+    size_t lo = from, hi = from, step = 1;
+    while (hi < v.size() && v[hi] < target) {
+        lo = hi + 1;
+        hi += step;
+        step <<= 1;
+    }
+    hi = std::min(hi + 1, v.size());
+    return std::lower_bound(v.begin() + lo, v.begin() + hi, target) - v.begin();
+}
+
+static bool better(const ScoredDoc& a, const ScoredDoc& b) {
+    return a.score > b.score || (a.score == b.score && a.doc < b.doc);
+}
+
+void TopK::push(uint32_t doc, double score) {
+    ScoredDoc d{doc, score};
+    if (!full()) {
+        heap_.push_back(d);
+        std::push_heap(heap_.begin(), heap_.end(), better);
+    } else if (k_ && better(d, heap_.front())) {
+        std::pop_heap(heap_.begin(), heap_.end(), better);
+        heap_.back() = d;
+        std::push_heap(heap_.begin(), heap_.end(), better);
+    }
+}
+
+void TopK::sorted(std::vector<ScoredDoc>& out) const {
+    out = heap_;
+    std::sort(out.begin(), out.end(), better);
+}
+
+bool DocFilter::accept(uint32_t d) {
+    if (deleted && is_deleted(*deleted, d)) return false;
+    if (allow) {
+        allow_at = gallop(*allow, allow_at, d);
+        if (allow_at >= allow->size() || (*allow)[allow_at] != d) return false;
+    }
+    if (deny) {
+        deny_at = gallop(*deny, deny_at, d);
+        if (deny_at < deny->size() && (*deny)[deny_at] == d) return false;
+    }
+    return true;
+}
+
+uint64_t wand_top_k(std::vector<TermCursor>& cursors, const Bm25& bm25,
+                    const uint32_t* doc_lens, uint32_t doc_lens_count, uint32_t doc_base,
+                    DocFilter& filter, TopK& top) {
+    std::vector<TermCursor*> live;
+    for (auto& c : cursors) {
+        if (!c.done()) live.push_back(&c);
+    }
+
+    uint64_t scored = 0;
+    while (!live.empty()) {
+        std::sort(live.begin(), live.end(), [](const TermCursor* a, const TermCursor* b) {
+            return a->doc() < b->doc();
+        });
+
+        double theta = top.threshold();
+        double acc = 0;
+        size_t pivot = live.size();
+        for (size_t i = 0; i < live.size(); ++i) {
+            acc += live[i]->ub;
+            if (acc > theta) { pivot = i; break; }
+        }
+        if (pivot == live.size()) break;
+
+        uint32_t d = live[pivot]->doc();
+        while (pivot + 1 < live.size() && live[pivot + 1]->doc() == d) ++pivot;
+
+        double block_sum = 0;
+        uint64_t skip_to = UINT32_MAX;
+        for (size_t i = 0; i <= pivot; ++i) {
+            uint32_t b = live[i]->list.find_block(d);
+            if (b == PostingCursor::kNoBlock) continue;
+            block_sum += live[i]->block_ub(b, bm25);
+            skip_to = std::min<uint64_t>(skip_to, (uint64_t)live[i]->list.block_last(b) + 1);
+        }
+        if (block_sum <= theta) {
+            if (pivot + 1 < live.size()) skip_to = std::min<uint64_t>(skip_to, live[pivot + 1]->doc());
+            for (size_t i = 0; i <= pivot; ++i) live[i]->list.seek((uint32_t)skip_to);
+        } else if (live[0]->doc() == d) {
+            bool ok = filter.accept(d);
+            uint32_t dl = d < doc_lens_count ? doc_lens[d] : 0;
+            double score = 0;
+            for (size_t i = 0; i <= pivot; ++i) {
+                if (ok) score += live[i]->idf * bm25.tf_part(live[i]->list.tf(), dl);
+                live[i]->list.next();
+            }
+            if (ok) {
+                top.push(doc_base + d, score);
+                ++scored;
+            }
+        } else {
+            for (size_t i = 0; i < pivot; ++i) live[i]->list.seek(d);
+        }
+
+        live.erase(std::remove_if(live.begin(), live.end(),
+                                  [](const TermCursor* c) { return c->done(); }),
+                   live.end());
+    }
+    return scored;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "index_io.h"
+
+// Okapi BM25 term weight: idf * tf (k1 + 1) / (tf + k1 (1 - b + b dl / avgdl)).
+struct Bm25 {
+  double k1 = 1.2;
+  double b = 0.75;
+  double avgdl = 1.0;
+
+  static double idf(uint64_t doc_count, uint64_t df);
+  double tf_part(uint32_t tf, uint32_t dl) const;
+};
+
+// One query term in one segment. tf_part grows with tf and falls with dl, so
+// idf * tf_part(max tf, min dl) bounds the term's contribution: ub over the
+// whole list from the lexicon, block_ub over one block from its skip entry.
+struct TermCursor {
+  PostingCursor list;
+  double idf = 0;
+  double ub = 0;
+
+  bool done() const { return list.done(); }
+  uint32_t doc() const { return list.doc(); }
+  double block_ub(uint32_t b, const Bm25& bm25) const {
+    return idf * bm25.tf_part(list.block_max_tf(b), list.block_min_dl(b));
+  }
+};
+
+struct ScoredDoc {
+  uint32_t doc;
+  double score;
+};
+
+// The k best documents seen so far, by score and then by lower doc id.
+class TopK {
+ public:
+  explicit TopK(size_t k) : k_(k) {}
+
+  bool full() const { return heap_.size() >= k_; }
+  double threshold() const { return full() && k_ ? heap_.front().score : -1.0; }
+  void push(uint32_t doc, double score);
+  void sorted(std::vector<ScoredDoc>& out) const;
+
+ private:
+  size_t k_;
+  std::vector<ScoredDoc> heap_;
+};
+
+// A document passes when it is in allow (if set), not in deny (if set) and
+// not deleted. Documents must be asked for in increasing order.
+struct DocFilter {
+  const std::vector<uint32_t>* allow = nullptr;
+  const std::vector<uint32_t>* deny = nullptr;
+  const std::vector<uint8_t>* deleted = nullptr;
+  size_t allow_at = 0;
+  size_t deny_at = 0;
+
+  bool accept(uint32_t d);
+};
+
+// Block-max WAND over the cursors of one segment: a document is scored only
+// when the upper bounds of the lists at or before it can beat the k-th best
+// score so far, first by whole-list and then by per-block bounds; otherwise
+// the lists jump ahead without decoding the blocks in between. Returns the
+// number of documents scored. Pushes doc_base + local id into top.
+uint64_t wand_top_k(std::vector<TermCursor>& cursors, const Bm25& bm25,
+                    const uint32_t* doc_lens, uint32_t doc_lens_count, uint32_t doc_base,
+                    DocFilter& filter, TopK& top);
@@ -0,0 +1,65 @@
+#include "run_merge.h"
+
+#include <algorithm>
+#include <cstring>
+
+BufferedReader::BufferedReader(size_t buf_size) : buf_(buf_size) {}
+
+BufferedReader::~BufferedReader() { close(); }
+
+BufferedReader::BufferedReader(BufferedReader&& o) noexcept
+    : f_(o.f_), buf_(std::move(o.buf_)), pos_(o.pos_), len_(o.len_) {
+    o.f_ = nullptr;
+    o.pos_ = o.len_ = 0;
+}
+
+bool BufferedReader::open(const std::string& path) {
+    close();
+    f_ = std::fopen(path.c_str(), "rb");
+    pos_ = len_ = 0;
+    return f_ != nullptr;
+}
+
+void BufferedReader::close() {
+    if (f_) std::fclose(f_);
+    f_ = nullptr;
+}
+
+bool BufferedReader::refill() {
+    if (!f_) return false;
+    pos_ = 0;
+    len_ = std::fread(buf_.data(), 1, buf_.size(), f_);
+    return len_ > 0;
+}
+
+bool BufferedReader::read(void* dst, size_t n) {
+    char* p = static_cast<char*>(dst);
+    while (n > 0) {
+        if (pos_ == len_ && !refill()) return false;
+        size_t k = std::min(n, len_ - pos_);
+        std::memcpy(p, buf_.data() + pos_, k);
+        pos_ += k;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+bool BufferedReader::read_line(std::string& out) {
+    out.clear();
+    bool any = false;
+    while (true) {
+        if (pos_ == len_ && !refill()) return any;
+        any = true;
+        const char* b = buf_.data() + pos_;
+        const void* nl = std::memchr(b, '\n', len_ - pos_);
+        if (nl) {
+            size_t k = static_cast<const char*>(nl) - b;
+            out.append(b, k);
+            pos_ += k + 1;
+            return true;
+        }
+        out.append(b, len_ - pos_);
+        pos_ = len_;
+    }
+}
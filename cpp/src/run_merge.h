@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+class BufferedReader {
+ public:
+  static constexpr size_t kDefaultBufSize = 1 << 18;
+
+  explicit BufferedReader(size_t buf_size = kDefaultBufSize);
+  ~BufferedReader();
+  BufferedReader(BufferedReader&& o) noexcept;
+  BufferedReader(const BufferedReader&) = delete;
+  BufferedReader& operator=(const BufferedReader&) = delete;
+
+  bool open(const std::string& path);
+  void close();
+
+  bool read(void* dst, size_t n);
+  bool read_line(std::string& out);
+
+ private:
+  bool refill();
+
+  FILE* f_ = nullptr;
+  std::vector<char> buf_;
+  size_t pos_ = 0;
+  size_t len_ = 0;
+};
+
+// Tournament tree of losers over k sorted sources. Source must expose a
+// `valid` flag; cmp(a, b) is a three-way comparison of the current heads.
+// After consuming and advancing src[top()], call replay(): it costs
+// ceil(log2 k) comparisons instead of a scan over all sources.
+template <class Source, class Cmp>
+class LoserTree {
+ public:
+  LoserTree(std::vector<Source>& src, Cmp cmp) : src_(src), cmp_(cmp) { build(); }
+
+  int top() const {
+    if (src_.empty()) return -1;
+    int w = tree_[0];
+    return src_[w].valid ? w : -1;
+  }
+
+  void replay() {
+    int k = (int)src_.size();
+    int w = tree_[0];
+    for (int n = (w + k) / 2; n >= 1; n /= 2) {
+      if (beats(tree_[n], w)) std::swap(tree_[n], w);
+    }
+    tree_[0] = w;
+  }
+
+ private:
+  bool beats(int a, int b) const {
+    if (!src_[a].valid) return !src_[b].valid && a < b;
+    if (!src_[b].valid) return true;
+    int c = cmp_(src_[a], src_[b]);
+    if (c != 0) return c < 0;
+    return a < b;
+  }
+
+  void build() {
+    int k = (int)src_.size();
+    if (k == 0) return;
+    tree_.assign(k, 0);
+    std::vector<int> win(2 * k);
+    for (int i = 0; i < k; ++i) win[k + i] = i;
+    for (int n = k - 1; n >= 1; --n) {
+      int a = win[2 * n];
+      int b = win[2 * n + 1];
+      if (beats(a, b)) { win[n] = a; tree_[n] = b; }
+      else { win[n] = b; tree_[n] = a; }
+    }
+    tree_[0] = (k == 1) ? 0 : win[1];
+  }
+
+  std::vector<Source>& src_;
+  Cmp cmp_;
+  std::vector<int> tree_;
+};
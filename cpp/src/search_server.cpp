@@ -0,0 +1,437 @@
+#include "search_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Job {
+    uint64_t conn;
+    uint64_t seq;
+    std::string line;
+};
+
+struct Reply {
+    uint64_t conn;
+    uint64_t seq;
+    std::string text;
+};
+
+struct Conn {
+    int fd = -1;
+    std::string in;
+    std::string out;
+    uint64_t next_seq = 0;
+    uint64_t next_send = 0;
+    std::map<uint64_t, std::string> ready;
+    bool eof = false;
+    uint32_t events = EPOLLIN | EPOLLRDHUP;
+};
+
+class JobQueue {
+ public:
+    void push(Job j) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            jobs_.push_back(std::move(j));
+        }
+        cv_.notify_one();
+    }
+
+    bool pop(Job& j) {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [&] { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) return false;
+        j = std::move(jobs_.front());
+        jobs_.pop_front();
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+            jobs_.clear();
+        }
+        cv_.notify_all();
+    }
+
+ private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    bool stop_ = false;
+};
+
+// Finished replies, handed from the workers to the event loop.
+class ReplyQueue {
+ public:
+    explicit ReplyQueue(int wake_fd) : wake_fd_(wake_fd) {}
+
+    void push(Reply r) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            replies_.push_back(std::move(r));
+        }
+        uint64_t one = 1;
+        ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+        (void)n;
+    }
+
+    void take(std::vector<Reply>& out) {
+        uint64_t count;
+        ssize_t n = ::read(wake_fd_, &count, sizeof(count));
+        (void)n;
+        std::lock_guard<std::mutex> lk(mu_);
+        out.swap(replies_);
+    }
+
+ private:
+    int wake_fd_;
+    std::mutex mu_;
+    std::vector<Reply> replies_;
+};
+
+static const uint64_t kListenId = 0;
+static const uint64_t kWakeId = 1;
+static const uint64_t kSignalId = 2;
+static const uint64_t kFirstConnId = 3;
+
+static int listen_socket(const ServerConfig& cfg) {
+    int fd;
+    if (!cfg.socket_path.empty()) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (cfg.socket_path.size() >= sizeof(addr.sun_path)) return -1;
+        std::memcpy(addr.sun_path, cfg.socket_path.c_str(), cfg.socket_path.size() + 1);
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        ::unlink(cfg.socket_path.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    } else {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(cfg.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        int one = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    }
+    if (::listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void watch(int ep, int fd, uint64_t id, uint32_t events, int op) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = id;
+    ::epoll_ctl(ep, op, fd, &ev);
+}
+
+class EventLoop {
+ public:
+    EventLoop(int ep, size_t max_line, JobQueue& jobs)
+        : ep_(ep), max_line_(max_line), jobs_(jobs) {}
+
+    ~EventLoop() {
+        for (auto& kv : conns_) ::close(kv.second.fd);
+    }
+
+    void accept_all(int listen_fd) {
+        for (;;) {
+            int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            uint64_t id = next_id_++;
+            conns_[id].fd = fd;
+            watch(ep_, fd, id, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+        }
+    }
+
+    void on_event(uint64_t id, uint32_t events) {
+        auto it = conns_.find(id);
+        if (it == conns_.end()) return;
+        Conn& c = it->second;
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            close_conn(id);
+            return;
+        }
+        if ((events & (EPOLLIN | EPOLLRDHUP)) && !read_requests(id, c)) {
+            close_conn(id);
+            return;
+        }
+        if (!flush(id, c)) close_conn(id);
+    }
+
+    void deliver(std::vector<Reply>& replies) {
+        for (auto& r : replies) {
+            auto it = conns_.find(r.conn);
+            if (it == conns_.end()) continue;
+            it->second.ready[r.seq] = std::move(r.text);
+        }
+        for (auto& r : replies) {
+            auto it = conns_.find(r.conn);
+            if (it != conns_.end() && !flush(r.conn, it->second)) close_conn(r.conn);
+        }
+        replies.clear();
+    }
+
+ private:
+    bool read_requests(uint64_t id, Conn& c) {
+        char buf[16384];
+        for (;;) {
+            ssize_t n = ::read(c.fd, buf, sizeof(buf));
+            if (n > 0) {
+                c.in.append(buf, (size_t)n);
+                continue;
+            }
+            if (n == 0) c.eof = true;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return false;
+            break;
+        }
+
+        size_t start = 0;
+        for (size_t nl; (nl = c.in.find('\n', start)) != std::string::npos; start = nl + 1) {
+            size_t end = nl;
+            if (end > start && c.in[end - 1] == '\r') --end;
+            if (end == start) continue;
+            jobs_.push({id, c.next_seq++, c.in.substr(start, end - start)});
+        }
+        c.in.erase(0, start);
+        return c.in.size() <= max_line_;
+    }
+
+    // Moves in-order replies to the output buffer and writes what the socket
+    // takes. Returns false once the connection should be closed.
+    bool flush(uint64_t id, Conn& c) {
+        for (auto it = c.ready.begin(); it != c.ready.end() && it->first == c.next_send;
+             it = c.ready.erase(it)) {
+            c.out += it->second;
+            ++c.next_send;
+        }
+        while (!c.out.empty()) {
+            ssize_t n = ::send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+                c.out.erase(0, (size_t)n);
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+        if (c.out.empty() && c.eof && c.next_send == c.next_seq) return false;
+
+        uint32_t events = 0;
+        if (!c.out.empty()) events |= EPOLLOUT;
+        if (!c.eof) events |= EPOLLIN | EPOLLRDHUP;
+        if (events != c.events) {
+            c.events = events;
+            watch(ep_, c.fd, id, events, EPOLL_CTL_MOD);
+        }
+        return true;
+    }
+
+    void close_conn(uint64_t id) {
+        auto it = conns_.find(id);
+        if (it == conns_.end()) return;
+        ::epoll_ctl(ep_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        ::close(it->second.fd);
+        conns_.erase(it);
+    }
+
+    int ep_;
+    size_t max_line_;
+    JobQueue& jobs_;
+    uint64_t next_id_ = kFirstConnId;
+    std::unordered_map<uint64_t, Conn> conns_;
+};
+
+int run_server(const ServerConfig& cfg, const RequestHandler& handler) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (::pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) return 1;
+
+    int listen_fd = listen_socket(cfg);
+    if (listen_fd < 0) return 1;
+    int ep = ::epoll_create1(EPOLL_CLOEXEC);
+    int wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int sig_fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (ep < 0 || wake_fd < 0 || sig_fd < 0) return 1;
+    watch(ep, listen_fd, kListenId, EPOLLIN, EPOLL_CTL_ADD);
+    watch(ep, wake_fd, kWakeId, EPOLLIN, EPOLL_CTL_ADD);
+    watch(ep, sig_fd, kSignalId, EPOLLIN, EPOLL_CTL_ADD);
+
+    JobQueue jobs;
+    ReplyQueue replies(wake_fd);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::max(1, cfg.threads); ++i) {
+        workers.emplace_back([&] {
+            Job j;
+            while (jobs.pop(j)) replies.push({j.conn, j.seq, handler(j.line)});
+        });
+    }
+
+    {
+        EventLoop loop(ep, cfg.max_line, jobs);
+        std::vector<Reply> done;
+        epoll_event events[64];
+        bool running = true;
+        while (running) {
+            int n = ::epoll_wait(ep, events, 64, -1);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; ++i) {
+                uint64_t id = events[i].data.u64;
+                if (id == kListenId) {
+                    loop.accept_all(listen_fd);
+                } else if (id == kWakeId) {
+                    replies.take(done);
+                    loop.deliver(done);
+                } else if (id == kSignalId) {
+                    running = false;
+                } else {
+                    loop.on_event(id, events[i].events);
+                }
+            }
+        }
+        jobs.stop();
+        for (auto& t : workers) t.join();
+    }
+
+    ::close(sig_fd);
+    ::close(wake_fd);
+    ::close(ep);
+    ::close(listen_fd);
+    if (!cfg.socket_path.empty()) ::unlink(cfg.socket_path.c_str());
+    return 0;
+}
+
+ServerClient::~ServerClient() {
+    for (int fd : idle_) ::close(fd);
+}
+
+int ServerClient::connect_endpoint() const {
+    bool tcp = !endpoint_.empty() &&
+               std::all_of(endpoint_.begin(), endpoint_.end(), [](char ch) { return ch >= '0' && ch <= '9'; });
+    int fd;
+    if (tcp) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)std::stoul(endpoint_));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    } else {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (endpoint_.size() >= sizeof(addr.sun_path)) return -1;
+        std::memcpy(addr.sun_path, endpoint_.c_str(), endpoint_.size() + 1);
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const std::string& s) {
+    for (size_t done = 0; done < s.size();) {
+        ssize_t n = ::send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+// Reads until the reply is complete: the status line plus, after "OK <n>",
+// n more lines.
+static bool read_reply(int fd, std::string& reply) {
+    reply.clear();
+    size_t lines = 0, want = 1, scanned = 0;
+    char buf[16384];
+    while (lines < want) {
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        reply.append(buf, (size_t)n);
+        for (; scanned < reply.size(); ++scanned) {
+            if (reply[scanned] != '\n') continue;
+            if (++lines == 1 && reply.compare(0, 3, "OK ") == 0) {
+                want += (size_t)std::strtoul(reply.c_str() + 3, nullptr, 10);
+            }
+        }
+    }
+    return true;
+}
+
+void ServerClient::send(const std::string& line, Call& c) {
+    c.line = line + "\n";
+    c.fd = -1;
+    c.reused = false;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!idle_.empty()) {
+            c.fd = idle_.back();
+            idle_.pop_back();
+            c.reused = true;
+        }
+    }
+    if (c.fd < 0) c.fd = connect_endpoint();
+    if (c.fd >= 0 && !send_all(c.fd, c.line)) {
+        ::close(c.fd);
+        c.fd = -1;
+    }
+}
+
+bool ServerClient::receive(Call& c, std::string& reply) {
+    if (c.fd >= 0 && read_reply(c.fd, reply)) {
+        std::lock_guard<std::mutex> lk(mu_);
+        idle_.push_back(c.fd);
+        return true;
+    }
+    if (c.fd >= 0) ::close(c.fd);
+    c.fd = c.reused ? connect_endpoint() : -1;
+    if (c.fd >= 0 && send_all(c.fd, c.line) && read_reply(c.fd, reply)) {
+        std::lock_guard<std::mutex> lk(mu_);
+        idle_.push_back(c.fd);
+        return true;
+    }
+    if (c.fd >= 0) ::close(c.fd);
+    c.fd = -1;
+    return false;
+}
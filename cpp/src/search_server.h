@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Line protocol server: every request is one line and is answered with the
+// text the handler returns for it (newline terminated). Connections are
+// served by one epoll loop; requests are evaluated by a pool of worker
+// threads, and replies on a connection keep the order of its requests.
+struct ServerConfig {
+  std::string socket_path;  // Unix domain socket, if set
+  uint16_t port = 0;        // otherwise TCP on 127.0.0.1
+  int threads = 1;
+  size_t max_line = 1 << 16;
+};
+
+// Called concurrently from the worker threads.
+using RequestHandler = std::function<std::string(const std::string& line)>;
+
+// Serves until SIGINT or SIGTERM. Returns 0 after a clean stop, non-zero if
+// the socket cannot be set up.
+int run_server(const ServerConfig& cfg, const RequestHandler& handler);
+
+// Blocking client for the same protocol, used to fan requests out to other
+// servers. Idle connections are kept for reuse; safe to share between
+// threads.
+class ServerClient {
+ public:
+  // A request sent but not yet answered; it holds its connection.
+  struct Call {
+    int fd = -1;
+    bool reused = false;
+    std::string line;
+  };
+
+  // endpoint: a Unix socket path, or a TCP port on 127.0.0.1 if all digits.
+  explicit ServerClient(std::string endpoint) : endpoint_(std::move(endpoint)) {}
+  ~ServerClient();
+  ServerClient(const ServerClient&) = delete;
+  ServerClient& operator=(const ServerClient&) = delete;
+
+  const std::string& endpoint() const { return endpoint_; }
+  // Sends one request line without waiting, so several servers can work on
+  // it at once.
+  void send(const std::string& line, Call& c);
+  // Waits for the reply to send(): "OK <n>" with its n lines, or the "ERR"
+  // line. A pooled connection the server has closed since is retried once on
+  // a fresh one. Returns false if the server cannot be reached.
+  bool receive(Call& c, std::string& reply);
+
+ private:
+  int connect_endpoint() const;
+
+  std::string endpoint_;
+  std::mutex mu_;
+  std::vector<int> idle_;
+};
@@ -0,0 +1,234 @@
+#include "set_ops.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SET_OPS_X86 1
+#endif
+
+// First index in [lo, n) with b[index] >= x: doubles the step from lo until
+// it overshoots, then binary searches the last step.
+static size_t gallop(const uint32_t* b, size_t lo, size_t n, uint32_t x) {
+    size_t hi = lo;
+    for (size_t step = 1; hi < n && b[hi] < x; step <<= 1) {
+        lo = hi + 1;
+        hi += step;
+    }
+    return std::lower_bound(b + lo, b + std::min(hi, n), x) - b;
+}
+
+static size_t intersect_scalar(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        uint32_t x = a[i], y = b[j];
+        out[k] = x;
+        k += x == y;
+        i += x <= y;
+        j += y <= x;
+    }
+    return k;
+}
+
+size_t intersect_gallop(const uint32_t* small, size_t ns, const uint32_t* large, size_t nl, uint32_t* out) {
+    size_t j = 0, k = 0;
+    for (size_t i = 0; i < ns && j < nl; ++i) {
+        j = gallop(large, j, nl, small[i]);
+        if (j < nl && large[j] == small[i]) out[k++] = small[i];
+    }
+    return k;
+}
+
+#ifdef SET_OPS_X86
+
+// Compaction masks by match bitmask: pshufb byte indexes for 4 lanes and
+// vpermd lane indexes for 8, set lanes first.
+struct ShuffleTables {
+    alignas(16) uint8_t sse[16][16];
+    alignas(32) uint32_t avx2[256][8];
+
+    ShuffleTables() {
+        for (int m = 0; m < 16; ++m) {
+            int n = 0;
+            std::memset(sse[m], 0x80, 16);
+            for (int l = 0; l < 4; ++l) {
+                if (!(m >> l & 1)) continue;
+                for (int b = 0; b < 4; ++b) sse[m][n * 4 + b] = (uint8_t)(l * 4 + b);
+                ++n;
+            }
+        }
+        for (int m = 0; m < 256; ++m) {
+            int n = 0;
+            for (int l = 0; l < 8; ++l) {
+                if (m >> l & 1) avx2[m][n++] = (uint32_t)l;
+            }
+            while (n < 8) avx2[m][n++] = 0;
+        }
+    }
+};
+
+static const ShuffleTables& shuffle_tables() {
+    static const ShuffleTables t;
+    return t;
+}
+
+// Block-wise intersection: every lane of a 4-id block of a is compared with
+// every rotation of a block of b, the matching lanes are packed to the front
+// and stored, and the block with the smaller last id moves on. The rest is
+// finished by the scalar merge.
+__attribute__((target("sse4.2")))
+static size_t intersect_sse4(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    const ShuffleTables& t = shuffle_tables();
+    size_t i = 0, j = 0, k = 0;
+    size_t ea = na & ~size_t(3), eb = nb & ~size_t(3);
+    while (i < ea && j < eb) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        __m128i m01 = _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                                   _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+        __m128i m23 = _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                                   _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(m01, m23)));
+        __m128i shuf = _mm_load_si128(reinterpret_cast<const __m128i*>(t.sse[mask]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), _mm_shuffle_epi8(va, shuf));
+        k += (size_t)__builtin_popcount(mask);
+        uint32_t amax = a[i + 3], bmax = b[j + 3];
+        i += amax <= bmax ? 4 : 0;
+        j += bmax <= amax ? 4 : 0;
+    }
+    return k + intersect_scalar(a + i, na - i, b + j, nb - j, out + k);
+}
+
+__attribute__((target("avx2")))
+static size_t intersect_avx2(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    const ShuffleTables& t = shuffle_tables();
+    const __m256i rot = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    size_t i = 0, j = 0, k = 0;
+    size_t ea = na & ~size_t(7), eb = nb & ~size_t(7);
+    while (i < ea && j < eb) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        __m256i m = _mm256_cmpeq_epi32(va, vb);
+        for (int r = 1; r < 8; ++r) {
+            vb = _mm256_permutevar8x32_epi32(vb, rot);
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi32(va, vb));
+        }
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+        __m256i perm = _mm256_load_si256(reinterpret_cast<const __m256i*>(t.avx2[mask]));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k), _mm256_permutevar8x32_epi32(va, perm));
+        k += (size_t)__builtin_popcount(mask);
+        uint32_t amax = a[i + 7], bmax = b[j + 7];
+        i += amax <= bmax ? 8 : 0;
+        j += bmax <= amax ? 8 : 0;
+    }
+    return k + intersect_scalar(a + i, na - i, b + j, nb - j, out + k);
+}
+
+static SetKernel detect_set_kernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SK_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SK_SSE4;
+    return SK_SCALAR;
+}
+
+#else
+
+static SetKernel detect_set_kernel() { return SK_SCALAR; }
+
+#endif
+
+SetKernel best_set_kernel() {
+    static const SetKernel k = detect_set_kernel();
+    return k;
+}
+
+const char* set_kernel_name(SetKernel k) {
+    if (k == SK_AVX2) return "avx2";
+    if (k == SK_SSE4) return "sse4";
+    return "scalar";
+}
+
+size_t intersect_sorted(SetKernel k, const uint32_t* a, size_t na,
+                        const uint32_t* b, size_t nb, uint32_t* out) {
+#ifdef SET_OPS_X86
+    if (k == SK_AVX2) return intersect_avx2(a, na, b, nb, out);
+    if (k == SK_SSE4) return intersect_sse4(a, na, b, nb, out);
+#endif
+    (void)k;
+    return intersect_scalar(a, na, b, nb, out);
+}
+
+static bool skewed(size_t small, size_t large, size_t ratio = kGallopRatio) { return large / ratio > small; }
+
+void intersect(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& out) {
+    const std::vector<uint32_t>& s = a.size() <= b.size() ? a : b;
+    const std::vector<uint32_t>& l = a.size() <= b.size() ? b : a;
+    if (s.empty()) {
+        out.clear();
+        return;
+    }
+    SetKernel k = best_set_kernel();
+    out.resize(s.size() + kSetSlack);
+    size_t n = skewed(s.size(), l.size(), k == SK_SCALAR ? kGallopRatio : 2 * kGallopRatio)
+                   ? intersect_gallop(s.data(), s.size(), l.data(), l.size(), out.data())
+                   : intersect_sorted(k, a.data(), a.size(), b.data(), b.size(), out.data());
+    out.resize(n);
+}
+
+void unite(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& out) {
+    out.resize(a.size() + b.size());
+    uint32_t* o = out.data();
+    const std::vector<uint32_t>& s = a.size() <= b.size() ? a : b;
+    const std::vector<uint32_t>& l = a.size() <= b.size() ? b : a;
+    size_t i = 0, j = 0;
+    if (skewed(s.size(), l.size())) {
+        // Copy the runs of the long list between consecutive ids of the short one.
+        for (; i < s.size(); ++i) {
+            size_t p = gallop(l.data(), j, l.size(), s[i]);
+            o = std::copy(l.data() + j, l.data() + p, o);
+            if (p < l.size() && l[p] == s[i]) ++p;
+            *o++ = s[i];
+            j = p;
+        }
+    } else {
+        while (i < s.size() && j < l.size()) {
+            uint32_t x = s[i], y = l[j];
+            *o++ = x <= y ? x : y;
+            i += x <= y;
+            j += y <= x;
+        }
+        o = std::copy(s.data() + i, s.data() + s.size(), o);
+    }
+    o = std::copy(l.data() + j, l.data() + l.size(), o);
+    out.resize((size_t)(o - out.data()));
+}
+
+void diff(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& out) {
+    out.resize(a.size());
+    uint32_t* o = out.data();
+    size_t i = 0, j = 0;
+    if (skewed(a.size(), b.size())) {
+        for (; i < a.size(); ++i) {
+            j = gallop(b.data(), j, b.size(), a[i]);
+            if (j == b.size() || b[j] != a[i]) *o++ = a[i];
+        }
+    } else if (skewed(b.size(), a.size())) {
+        for (; j < b.size(); ++j) {
+            size_t p = gallop(a.data(), i, a.size(), b[j]);
+            o = std::copy(a.data() + i, a.data() + p, o);
+            i = p < a.size() && a[p] == b[j] ? p + 1 : p;
+        }
+        o = std::copy(a.data() + i, a.data() + a.size(), o);
+    } else {
+        while (i < a.size() && j < b.size()) {
+            uint32_t x = a[i], y = b[j];
+            *o = x;
+            o += x < y;
+            i += x <= y;
+            j += y <= x;
+        }
+        o = std::copy(a.data() + i, a.data() + a.size(), o);
+    }
+    out.resize((size_t)(o - out.data()));
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Kernels over strictly increasing doc id lists. They switch from a merge to
+// galloping search once one list is more than kGallopRatio times longer than
+// the other; intersect merges with the widest vector kernel the CPU supports,
+// which keeps up with galloping up to twice that ratio.
+constexpr size_t kGallopRatio = 32;
+
+void intersect(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& out);
+void unite(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& out);
+void diff(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, std::vector<uint32_t>& out);
+
+enum SetKernel { SK_SCALAR, SK_SSE4, SK_AVX2 };
+
+// Chosen once from cpuid; every kernel up to it is usable.
+SetKernel best_set_kernel();
+const char* set_kernel_name(SetKernel k);
+
+// Writes a ∩ b to out and returns its length. out must have room for
+// min(na, nb) + kSetSlack ids: vector kernels store whole registers.
+constexpr size_t kSetSlack = 8;
+size_t intersect_sorted(SetKernel k, const uint32_t* a, size_t na,
+                        const uint32_t* b, size_t nb, uint32_t* out);
+size_t intersect_gallop(const uint32_t* small, size_t ns,
+                        const uint32_t* large, size_t nl, uint32_t* out);
@@ -0,0 +1,135 @@
+#include "index_io.h"
+#include "mapped_file.h"
+#include "set_ops.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The two-pointer merges the evaluator used before set_ops, kept as the
+// baseline.
+static void merge_intersect(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b,
+                            std::vector<uint32_t>& out) {
+    out.clear();
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (a[i] == b[j]) { out.push_back(a[i]); ++i; ++j; }
+        else if (a[i] < b[j]) ++i;
+        else ++j;
+    }
+}
+
+static void merge_unite(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b,
+                        std::vector<uint32_t>& out) {
+    out.clear();
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (a[i] == b[j]) { out.push_back(a[i]); ++i; ++j; }
+        else if (a[i] < b[j]) out.push_back(a[i++]);
+        else out.push_back(b[j++]);
+    }
+    while (i < a.size()) out.push_back(a[i++]);
+    while (j < b.size()) out.push_back(b[j++]);
+}
+
+static void merge_diff(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b,
+                       std::vector<uint32_t>& out) {
+    out.clear();
+    size_t i = 0, j = 0;
+    while (i < a.size()) {
+        if (j >= b.size()) out.push_back(a[i++]);
+        else if (a[i] == b[j]) { ++i; ++j; }
+        else if (a[i] < b[j]) out.push_back(a[i++]);
+        else ++j;
+    }
+}
+
+struct Pair {
+    size_t a;
+    size_t b;
+};
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: set_ops_bench <index_dir> [--rounds N] [--pairs N]\n";
+        return 1;
+    }
+    std::string dir = argv[1];
+    int rounds = 20;
+    size_t max_pairs = 64;
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--rounds" && i + 1 < argc) rounds = std::max(1, std::stoi(argv[++i]));
+        else if (a == "--pairs" && i + 1 < argc) max_pairs = (size_t)std::max(1, std::stoi(argv[++i]));
+    }
+
+    uint32_t version = 0, flags = 0;
+    std::vector<LexEntry> lex;
+    if (!load_terms(dir + "/terms.bin", lex, version, flags)) return 2;
+    MappedFile postings;
+    if (!postings.open(dir + "/postings.bin")) return 3;
+
+    // The most frequent terms, longest list first.
+    std::sort(lex.begin(), lex.end(), [](const LexEntry& x, const LexEntry& y) { return x.df > y.df; });
+    size_t top = std::min(lex.size(), (size_t)4096);
+    std::vector<std::vector<uint32_t>> lists(top);
+    for (size_t i = 0; i < top; ++i) read_postings(postings, version, flags, lex[i], lists[i]);
+
+    // Balanced pairs: neighbours by df among the longest lists. Skewed pairs:
+    // a long list against one at least kGallopRatio times shorter, spread
+    // over every shorter list that qualifies.
+    std::vector<Pair> balanced, skewed;
+    for (size_t i = 0; i + 1 < top && balanced.size() < max_pairs; i += 2) {
+        if (lists[i + 1].size() * 2 >= lists[i].size() && lists[i + 1].size() >= 64) balanced.push_back({i, i + 1});
+    }
+    size_t first_short = 0;
+    while (first_short < top && lists[first_short].size() * kGallopRatio >= lists[0].size()) ++first_short;
+    for (size_t i = 0; first_short < top && i < max_pairs; ++i) {
+        size_t j = first_short + i * (top - first_short) / max_pairs;
+        if (!lists[j].empty()) skewed.push_back({i, j});
+    }
+
+    std::vector<uint32_t> out;
+    uint64_t checksum = 0;
+    auto time_pairs = [&](const std::vector<Pair>& pairs, auto&& op) {
+        uint64_t ids = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            for (const auto& p : pairs) {
+                op(lists[p.a], lists[p.b], out);
+                checksum += out.size();
+                ids += lists[p.a].size() + lists[p.b].size();
+            }
+        }
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        return t > 0 ? (double)ids / t / 1e6 : 0.0;
+    };
+
+    std::cout << "kernel=" << set_kernel_name(best_set_kernel()) << "\n";
+    std::cout << "balanced_pairs=" << balanced.size() << "\n";
+    std::cout << "skewed_pairs=" << skewed.size() << "\n";
+    for (int s = 0; s < 2; ++s) {
+        const std::vector<Pair>& pairs = s ? skewed : balanced;
+        std::string name = s ? "skewed" : "balanced";
+        std::cout << name << "_intersect_merge_mids_per_sec=" << time_pairs(pairs, merge_intersect) << "\n";
+        for (int k = SK_SCALAR; k <= best_set_kernel(); ++k) {
+            auto kernel = [k](const std::vector<uint32_t>& a, const std::vector<uint32_t>& b,
+                              std::vector<uint32_t>& o) {
+                o.resize(std::min(a.size(), b.size()) + kSetSlack);
+                o.resize(intersect_sorted((SetKernel)k, a.data(), a.size(), b.data(), b.size(), o.data()));
+            };
+            std::cout << name << "_intersect_" << set_kernel_name((SetKernel)k)
+                      << "_mids_per_sec=" << time_pairs(pairs, kernel) << "\n";
+        }
+        std::cout << name << "_intersect_mids_per_sec=" << time_pairs(pairs, intersect) << "\n";
+        std::cout << name << "_unite_merge_mids_per_sec=" << time_pairs(pairs, merge_unite) << "\n";
+        std::cout << name << "_unite_mids_per_sec=" << time_pairs(pairs, unite) << "\n";
+        std::cout << name << "_diff_merge_mids_per_sec=" << time_pairs(pairs, merge_diff) << "\n";
+        std::cout << name << "_diff_mids_per_sec=" << time_pairs(pairs, diff) << "\n";
+    }
+    std::cout << "checksum=" << checksum << "\n";
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "text_tokenizer.h"
+#include "word_stemmer.h"
+#include "fs_utils.h"
+#include "string_sort.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// The top-down merge sort fs_utils had before string_sort, kept as the
+// baseline.
+static void merge_sort_strings_rec(std::vector<std::string>& a, std::vector<std::string>& tmp,
+                                   size_t l, size_t r) {
+    if (r - l <= 1) return;
+    size_t m = (l + r) / 2;
+    merge_sort_strings_rec(a, tmp, l, m);
+    merge_sort_strings_rec(a, tmp, m, r);
+    size_t i = l, j = m, k = l;
+    while (i < m && j < r) {
+        if (a[i] <= a[j]) tmp[k++] = a[i++];
+        else tmp[k++] = a[j++];
+    }
+    while (i < m) tmp[k++] = a[i++];
+    while (j < r) tmp[k++] = a[j++];
+    for (size_t p = l; p < r; ++p) a[p] = tmp[p];
+}
+
+static void merge_sort_strings(std::vector<std::string>& a) {
+    std::vector<std::string> tmp(a.size());
+    merge_sort_strings_rec(a, tmp, 0, a.size());
+}
+
+template <class T, class F>
+static double time_sort(const std::vector<T>& input, std::vector<T>& out, F&& sort) {
+    out = input;
+    auto t0 = std::chrono::steady_clock::now();
+    sort(out);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: sort_bench <docs_list.txt> [--tokens N] [--stemming 0|1] [--threads N]\n";
+        return 1;
+    }
+    size_t max_tokens = 2000000;
+    bool use_stemming = true;
+    int threads = 4;
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--tokens" && i + 1 < argc) max_tokens = std::stoul(argv[++i]);
+        else if (a == "--stemming" && i + 1 < argc) use_stemming = std::string(argv[++i]) == "1";
+        else if (a == "--threads" && i + 1 < argc) threads = std::max(1, std::stoi(argv[++i]));
+    }
+
+    std::ifstream list(argv[1]);
+    if (!list) return 2;
+    TokenizerConfig tc;
+    Tokenizer tokenizer(tc);
+    RussianStemmer stemmer;
+    std::vector<std::string> tokens, toks;
+    std::string path, text;
+    while (tokens.size() < max_tokens && std::getline(list, path)) {
+        if (!read_file_utf8(trim(path), text)) continue;
+        tokenizer.tokenize(text, toks);
+        for (auto& t : toks) {
+            if (tokens.size() >= max_tokens) break;
+            if (use_stemming) stemmer.stem(t);
+            tokens.push_back(t);
+        }
+    }
+    // The distinct terms in no particular order, as TermDict::sorted_ids
+    // gets them.
+    std::vector<std::string> distinct = tokens;
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    std::vector<std::string_view> views(distinct.begin(), distinct.end());
+    std::shuffle(views.begin(), views.end(), std::mt19937(1));
+
+    std::cout << "tokens=" << tokens.size() << "\n";
+    std::cout << "distinct_terms=" << views.size() << "\n";
+    bool same = true;
+
+    std::vector<std::string> ref, got;
+    std::cout << "strings_merge_sec=" << time_sort(tokens, ref, merge_sort_strings) << "\n";
+    std::cout << "strings_std_sort_sec="
+              << time_sort(tokens, got, [](std::vector<std::string>& v) { std::sort(v.begin(), v.end()); }) << "\n";
+    same &= got == ref;
+    std::cout << "strings_msd_sec=" << time_sort(tokens, got, [](std::vector<std::string>& v) { sort_strings(v); })
+              << "\n";
+    same &= got == ref;
+    std::cout << "strings_msd_" << threads << "t_sec="
+              << time_sort(tokens, got, [&](std::vector<std::string>& v) { sort_strings(v, threads); }) << "\n";
+    same &= got == ref;
+
+    std::vector<uint32_t> iref(views.size()), igot;
+    for (uint32_t i = 0; i < iref.size(); ++i) iref[i] = i;
+    auto t0 = std::chrono::steady_clock::now();
+    std::sort(iref.begin(), iref.end(), [&](uint32_t a, uint32_t b) { return views[a] < views[b]; });
+    std::cout << "term_ids_std_sort_sec="
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() << "\n";
+    t0 = std::chrono::steady_clock::now();
+    sort_string_ids(views, igot);
+    std::cout << "term_ids_msd_sec=" << std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count()
+              << "\n";
+    same &= igot == iref;
+
+    std::cout << "same=" << (same ? 1 : 0) << "\n";
+    return same ? 0 : 3;
+}
@@ -0,0 +1,92 @@
+#include "stem_cache.h"
+
+#include <cstring>
+
+// Multiply-xorshift over 8-byte words; the low bits pick the shard, the
+// middle ones the home slot and the high ones are the stored tag.
+static uint64_t hash_word(const std::string& s) {
+    uint64_t h = s.size() * 0x9E3779B97F4A7C15ull;
+    size_t i = 0;
+    for (; i + 8 <= s.size(); i += 8) {
+        uint64_t w;
+        std::memcpy(&w, s.data() + i, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    if (i < s.size()) {
+        uint64_t w = 0;
+        std::memcpy(&w, s.data() + i, s.size() - i);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 29);
+}
+
+StemCache::StemCache(size_t capacity) : shards_(new Shard[kShards]) {
+    size_t per_shard = kProbe;
+    while (per_shard * kShards < capacity) per_shard <<= 1;
+    mask_ = per_shard - 1;
+    for (size_t s = 0; s < kShards; ++s) {
+        shards_[s].slots.reset(new Slot[per_shard]);
+        std::memset(shards_[s].slots.get(), 0, per_shard * sizeof(Slot));
+    }
+}
+
+void StemCache::stem(std::string& token) {
+    uint64_t h = hash_word(token);
+    Shard& shard = shards_[h % kShards];
+    if (token.empty() || token.size() > kMaxKey || token.find('-') != std::string::npos) {
+        {
+            std::lock_guard<std::mutex> lock(shard.mu);
+            ++shard.bypassed;
+        }
+        stemmer_.stem(token);
+        return;
+    }
+
+    uint32_t tag = static_cast<uint32_t>(h >> 32);
+    size_t home = (h / kShards) & mask_;
+    {
+        std::lock_guard<std::mutex> lock(shard.mu);
+        for (size_t p = 0; p < kProbe; ++p) {
+            const Slot& slot = shard.slots[(home + p) & mask_];
+            if (slot.len == token.size() && slot.hash == tag && std::memcmp(slot.key, token.data(), slot.len) == 0) {
+                ++shard.hits;
+                token.resize(token.size() - slot.cut);
+                return;
+            }
+        }
+        ++shard.misses;
+    }
+
+    Slot fresh;
+    fresh.hash = tag;
+    fresh.len = static_cast<uint8_t>(token.size());
+    std::memcpy(fresh.key, token.data(), token.size());
+    stemmer_.stem(token);
+    fresh.cut = static_cast<uint8_t>(fresh.len - token.size());
+
+    std::lock_guard<std::mutex> lock(shard.mu);
+    size_t victim = (home + tag % kProbe) & mask_;
+    for (size_t p = 0; p < kProbe; ++p) {
+        const Slot& slot = shard.slots[(home + p) & mask_];
+        if (slot.len == 0 || (slot.len == fresh.len && slot.hash == tag &&
+                              std::memcmp(slot.key, fresh.key, fresh.len) == 0)) {
+            victim = (home + p) & mask_;
+            break;
+        }
+    }
+    shard.slots[victim] = fresh;
+}
+
+StemCacheStats StemCache::stats() const {
+    StemCacheStats st;
+    for (size_t s = 0; s < kShards; ++s) {
+        std::lock_guard<std::mutex> lock(shards_[s].mu);
+        st.hits += shards_[s].hits;
+        st.misses += shards_[s].misses;
+        st.bypassed += shards_[s].bypassed;
+    }
+    return st;
+}
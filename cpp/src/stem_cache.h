@@ -0,0 +1,55 @@
+#pragma once
+#include "word_stemmer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct StemCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t bypassed = 0;  // hyphenated or too long to cache
+
+  double hit_rate() const { return hits + misses ? (double)hits / (double)(hits + misses) : 0.0; }
+};
+
+// Bounded memo in front of RussianStemmer. A plain word's stem is a prefix of
+// it, so an entry keeps the word and how many bytes to cut. Words hash to one
+// of kShards shards, each an open-addressing table with its own lock; a word
+// is looked up in the kProbe slots after its home slot, and a miss with all
+// of them taken overwrites one. Safe to share between threads.
+class StemCache {
+ public:
+  static constexpr size_t kMaxKey = 26;
+  static constexpr size_t kShards = 64;
+  static constexpr size_t kProbe = 4;
+
+  // capacity: entries in total, rounded up to a power of two per shard.
+  explicit StemCache(size_t capacity);
+
+  // Same result as RussianStemmer::stem(token).
+  void stem(std::string& token);
+  StemCacheStats stats() const;
+
+ private:
+  struct Slot {
+    uint32_t hash;
+    uint8_t len;  // 0: empty
+    uint8_t cut;
+    char key[kMaxKey];
+  };
+
+  struct alignas(64) Shard {
+    mutable std::mutex mu;
+    std::unique_ptr<Slot[]> slots;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bypassed = 0;
+  };
+
+  RussianStemmer stemmer_;
+  size_t mask_ = 0;  // slots per shard - 1
+  std::unique_ptr<Shard[]> shards_;
+};
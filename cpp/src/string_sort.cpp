@@ -0,0 +1,120 @@
+#include "string_sort.h"
+#include "work_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+struct SortItem {
+    uint64_t key;
+    size_t id;
+};
+
+// Groups this small are sorted by comparing the strings themselves.
+static constexpr size_t kCompareSortCutoff = 32;
+
+// Bytes [depth, depth + 8) of s, big-endian and zero-padded, so keys compare
+// like the bytes. A string that ends inside the 8 bytes ties with one that
+// continues with zero bytes; see sort_items.
+static uint64_t prefix_key(std::string_view s, size_t depth) {
+    unsigned char buf[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    if (s.size() > depth) std::memcpy(buf, s.data() + depth, std::min<size_t>(8, s.size() - depth));
+    uint64_t k;
+    std::memcpy(&k, buf, 8);
+    return __builtin_bswap64(k);
+}
+
+// Src provides view(id) and tie(a, b), the order of equal strings.
+template <class Src>
+static void sort_items(SortItem* it, size_t n, size_t depth, const Src& src) {
+    if (n < 2) return;
+    if (n < kCompareSortCutoff) {
+        std::sort(it, it + n, [&](const SortItem& a, const SortItem& b) {
+            int c = src.view(a.id).substr(depth).compare(src.view(b.id).substr(depth));
+            return c < 0 || (c == 0 && src.tie(a.id, b.id));
+        });
+        return;
+    }
+
+    for (size_t i = 0; i < n; ++i) it[i].key = prefix_key(src.view(it[i].id), depth);
+    std::sort(it, it + n, [](const SortItem& a, const SortItem& b) { return a.key < b.key; });
+
+    for (size_t g = 0; g < n;) {
+        size_t e = g + 1;
+        while (e < n && it[e].key == it[g].key) ++e;
+        if (e - g > 1) {
+            // Strings that end within the key are prefixes (up to zero
+            // padding) of the rest of the group: they go first, shorter
+            // first, and only the rest is sorted on the next 8 bytes.
+            SortItem* cont = std::partition(it + g, it + e, [&](const SortItem& x) {
+                return src.view(x.id).size() <= depth + 8;
+            });
+            std::sort(it + g, cont, [&](const SortItem& a, const SortItem& b) {
+                size_t la = src.view(a.id).size(), lb = src.view(b.id).size();
+                return la < lb || (la == lb && src.tie(a.id, b.id));
+            });
+            sort_items(cont, (size_t)(it + e - cont), depth + 8, src);
+        }
+        g = e;
+    }
+}
+
+// The MSD pass: buckets by the first two bytes, zero-padded like the keys,
+// then sorts the buckets, largest first, on up to `threads` threads.
+template <class Src>
+static void sort_all(size_t n, const Src& src, int threads, std::vector<SortItem>& items) {
+    constexpr size_t kBuckets = 1 << 16;
+    std::vector<uint16_t> bucket(n);
+    std::vector<size_t> start(kBuckets + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+        bucket[i] = (uint16_t)(prefix_key(src.view(i), 0) >> 48);
+        ++start[bucket[i] + 1];
+    }
+    for (size_t b = 0; b < kBuckets; ++b) start[b + 1] += start[b];
+
+    items.resize(n);
+    std::vector<size_t> fill(start.begin(), start.end() - 1);
+    for (size_t i = 0; i < n; ++i) items[fill[bucket[i]]++] = {0, i};
+
+    std::vector<size_t> order;
+    for (size_t b = 0; b < kBuckets; ++b) {
+        if (start[b + 1] - start[b] > 1) order.push_back(b);
+    }
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+        return start[x + 1] - start[x] > start[y + 1] - start[y];
+    });
+
+    WorkPool pool(std::max(1, threads));
+    pool.run(order.size(), [&](size_t k) {
+        size_t b = order[k];
+        sort_items(items.data() + start[b], start[b + 1] - start[b], 0, src);
+    });
+}
+
+void sort_strings(std::vector<std::string>& a, int threads) {
+    struct Src {
+        const std::vector<std::string>& a;
+        std::string_view view(size_t id) const { return a[id]; }
+        bool tie(size_t, size_t) const { return false; }
+    };
+    std::vector<SortItem> items;
+    sort_all(a.size(), Src{a}, threads, items);
+
+    std::vector<std::string> out;
+    out.reserve(a.size());
+    for (const auto& x : items) out.push_back(std::move(a[x.id]));
+    a.swap(out);
+}
+
+void sort_string_ids(const std::vector<std::string_view>& terms, std::vector<uint32_t>& ids, int threads) {
+    struct Src {
+        const std::vector<std::string_view>& a;
+        std::string_view view(size_t id) const { return a[id]; }
+        bool tie(size_t, size_t) const { return false; }
+    };
+    std::vector<SortItem> items;
+    sort_all(terms.size(), Src{terms}, threads, items);
+
+    ids.resize(terms.size());
+    for (size_t i = 0; i < items.size(); ++i) ids[i] = (uint32_t)items[i].id;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Sorts in byte order of the strings (std::string's operator<). One counting
+// pass buckets the items by their first two bytes; each bucket is then sorted
+// multikey style on 8-byte big-endian prefix keys held next to the item ids,
+// so comparisons do not touch the strings, and only groups that tie on a key
+// move on to the next 8 bytes. With threads > 1 the buckets are sorted in
+// parallel.
+void sort_strings(std::vector<std::string>& a, int threads = 1);
+// Sets ids to the indexes of terms in byte order of the terms.
+void sort_string_ids(const std::vector<std::string_view>& terms, std::vector<uint32_t>& ids, int threads = 1);
@@ -0,0 +1,166 @@
+#include "term_counts.h"
+#include "run_merge.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <utility>
+
+TermCounter::TermCounter(std::string spill_prefix, size_t mem_bytes)
+    : spill_prefix_(std::move(spill_prefix)), mem_bytes_(std::max(mem_bytes, kMinMemBytes)) {}
+
+size_t TermCounter::memory_bytes() const {
+    return dict_.memory_bytes() + cf_.capacity() * sizeof(uint64_t) +
+           (df_.capacity() + last_doc_.capacity()) * sizeof(uint32_t);
+}
+
+static bool write_counts(std::ostream& out, const TermDict& dict, const std::vector<uint32_t>& order,
+                         const std::vector<uint64_t>& cf, const std::vector<uint32_t>& df) {
+    for (uint32_t id : order) {
+        std::string_view t = dict.term(id);
+        out.write(t.data(), static_cast<std::streamsize>(t.size()));
+        out << "\t" << cf[id] << "\t" << df[id] << "\n";
+    }
+    return (bool)out;
+}
+
+bool TermCounter::spill() {
+    std::string path = spill_prefix_ + std::to_string(partials_.size()) + ".tsv";
+    std::vector<uint32_t> order;
+    dict_.sorted_ids(order);
+    std::ofstream out(path, std::ios::binary);
+    if (!out || !write_counts(out, dict_, order, cf_, df_)) return false;
+    partials_.push_back(path);
+    // clear() would keep the capacity, and with it the counter over budget.
+    dict_ = TermDict();
+    cf_ = std::vector<uint64_t>();
+    df_ = std::vector<uint32_t>();
+    last_doc_ = std::vector<uint32_t>();
+    return true;
+}
+
+bool TermCounter::add_doc(const std::vector<std::string>& tokens, uint32_t doc) {
+    for (const auto& t : tokens) {
+        if (t.empty()) continue;
+        uint32_t id = dict_.intern(t);
+        if (id == cf_.size()) {
+            cf_.push_back(1);
+            df_.push_back(1);
+            last_doc_.push_back(doc);
+            continue;
+        }
+        ++cf_[id];
+        if (last_doc_[id] != doc) {
+            ++df_[id];
+            last_doc_[id] = doc;
+        }
+    }
+    return memory_bytes() <= mem_bytes_ || spill();
+}
+
+// One sorted source of (term, cf, df): a spilled partial, or what a counter
+// still holds in memory.
+struct TermCounter::Run {
+    BufferedReader in;
+    const TermCounter* mem = nullptr;
+    std::vector<uint32_t> order;
+    size_t at = 0;
+    bool valid = false;
+    std::string term;
+    uint64_t cf = 0;
+    uint64_t df = 0;
+    std::string line;
+
+    bool next() {
+        if (mem) {
+            valid = at < order.size();
+            if (valid) {
+                uint32_t id = order[at++];
+                term.assign(mem->dict_.term(id));
+                cf = mem->cf_[id];
+                df = mem->df_[id];
+            }
+            return valid;
+        }
+        valid = in.read_line(line);
+        if (!valid) return false;
+        size_t t2 = line.rfind('\t');
+        size_t t1 = t2 == std::string::npos || t2 == 0 ? std::string::npos : line.rfind('\t', t2 - 1);
+        if (t1 == std::string::npos) return valid = false;
+        term.assign(line, 0, t1);
+        cf = std::strtoull(line.c_str() + t1 + 1, nullptr, 10);
+        df = std::strtoull(line.c_str() + t2 + 1, nullptr, 10);
+        return valid;
+    }
+};
+
+bool TermCounter::write_merged(std::vector<Run>& runs, const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    auto cmp = [](const Run& a, const Run& b) { return a.term.compare(b.term); };
+    LoserTree<Run, decltype(cmp)> tree(runs, cmp);
+    std::string term;
+    uint64_t cf = 0, df = 0;
+    for (int best; (best = tree.top()) >= 0; ) {
+        Run& run = runs[best];
+        if (run.term != term) {
+            if (cf) out << term << "\t" << cf << "\t" << df << "\n";
+            term = run.term;
+            cf = df = 0;
+        }
+        cf += run.cf;
+        df += run.df;
+        run.next();
+        tree.replay();
+    }
+    if (cf) out << term << "\t" << cf << "\t" << df << "\n";
+    return (bool)out;
+}
+
+// Folds the partials kMergeFanIn at a time until the rest fit in the final
+// merge with the counts still in memory.
+bool TermCounter::merge(const std::vector<TermCounter>& counters, const std::string& output_path) {
+    std::vector<std::string> files, temps;
+    for (const auto& c : counters) files.insert(files.end(), c.partials_.begin(), c.partials_.end());
+    temps = files;
+
+    bool ok = true;
+    for (size_t pass = 0; ok && files.size() > kMergeFanIn; ++pass) {
+        std::vector<std::string> next;
+        for (size_t i = 0; ok && i < files.size(); i += kMergeFanIn) {
+            size_t end = std::min(files.size(), i + kMergeFanIn);
+            std::vector<Run> runs(end - i);
+            for (size_t k = i; ok && k < end; ++k) {
+                ok = runs[k - i].in.open(files[k]);
+                runs[k - i].next();
+            }
+            std::string path = counters[0].spill_prefix_ + "m" + std::to_string(pass) + "_" +
+                               std::to_string(next.size()) + ".tsv";
+            temps.push_back(path);
+            ok = ok && write_merged(runs, path);
+            next.push_back(path);
+        }
+        for (const auto& p : files) std::remove(p.c_str());
+        files.swap(next);
+    }
+
+    if (ok) {
+        std::vector<Run> runs(files.size() + counters.size());
+        size_t r = 0;
+        for (const auto& p : files) {
+            ok = ok && runs[r].in.open(p);
+            runs[r++].next();
+        }
+        for (const auto& c : counters) {
+            runs[r].mem = &c;
+            c.dict_.sorted_ids(runs[r].order);
+            runs[r++].next();
+        }
+        ok = ok && write_merged(runs, output_path);
+    }
+
+    for (const auto& p : temps) std::remove(p.c_str());
+    return ok;
+}
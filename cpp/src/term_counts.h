@@ -0,0 +1,49 @@
+#pragma once
+#include "term_dict.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Collection and document frequencies of terms, interned into a TermDict.
+// Once the counts outgrow mem_bytes they are spilled to
+// <spill_prefix><n>.tsv as a sorted partial in the output format (term, cf,
+// df). Meant to be used one per thread; merge() adds the counters up.
+class TermCounter {
+ public:
+  // A budget below kMinMemBytes is raised to it: the dictionary's first arena
+  // block alone would put the counter over budget after every document.
+  static constexpr size_t kMinMemBytes = 4 * TermDict::kBlockSize;
+  // merge() reads at most this many partials at once; more are first merged
+  // in passes into <spill_prefix>m<pass>_<n>.tsv.
+  static constexpr size_t kMergeFanIn = 64;
+
+  TermCounter(std::string spill_prefix, size_t mem_bytes);
+
+  // Counts one document's tokens; empty ones are skipped. The budget is only
+  // checked between documents, so df stays exact as long as every doc id is
+  // counted once, by one counter. False if a spill could not be written.
+  bool add_doc(const std::vector<std::string>& tokens, uint32_t doc);
+  size_t partial_count() const { return partials_.size(); }
+
+  // Writes the merged counts in byte order of the terms. The partials are
+  // removed whether or not it succeeds.
+  static bool merge(const std::vector<TermCounter>& counters, const std::string& output_path);
+
+ private:
+  struct Run;
+
+  static bool write_merged(std::vector<Run>& runs, const std::string& path);
+
+  size_t memory_bytes() const;
+  bool spill();
+
+  std::string spill_prefix_;
+  size_t mem_bytes_;
+  TermDict dict_;
+  std::vector<uint64_t> cf_;
+  std::vector<uint32_t> df_;
+  std::vector<uint32_t> last_doc_;
+  std::vector<std::string> partials_;
+};
@@ -0,0 +1,86 @@
+#include "term_dict.h"
+#include "string_sort.h"
+
+#include <algorithm>
+#include <cstring>
+
+static uint32_t hash_term(std::string_view s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+TermDict::TermDict() : slots_(1024, kEmpty) {}
+
+const char* TermDict::store(std::string_view s) {
+    if (s.empty()) return nullptr;
+    if (s.size() > kBlockSize / 4) {
+        std::unique_ptr<char[]> big(new char[s.size()]);
+        std::memcpy(big.get(), s.data(), s.size());
+        const char* p = big.get();
+        blocks_.insert(blocks_.empty() ? blocks_.end() : blocks_.end() - 1, std::move(big));
+        block_bytes_ += s.size();
+        return p;
+    }
+    if (block_used_ + s.size() > kBlockSize) {
+        blocks_.emplace_back(new char[kBlockSize]);
+        block_bytes_ += kBlockSize;
+        block_used_ = 0;
+    }
+    char* p = blocks_.back().get() + block_used_;
+    std::memcpy(p, s.data(), s.size());
+    block_used_ += s.size();
+    return p;
+}
+
+void TermDict::grow() {
+    std::vector<uint32_t> slots(slots_.size() * 2, kEmpty);
+    size_t mask = slots.size() - 1;
+    for (uint32_t id = 0; id < terms_.size(); ++id) {
+        size_t i = hashes_[id] & mask;
+        while (slots[i] != kEmpty) i = (i + 1) & mask;
+        slots[i] = id;
+    }
+    slots_.swap(slots);
+}
+
+uint32_t TermDict::intern(std::string_view s) {
+    uint32_t h = hash_term(s);
+    size_t mask = slots_.size() - 1;
+    size_t i = h & mask;
+    while (slots_[i] != kEmpty) {
+        uint32_t id = slots_[i];
+        if (hashes_[id] == h && terms_[id] == s) return id;
+        i = (i + 1) & mask;
+    }
+
+    uint32_t id = static_cast<uint32_t>(terms_.size());
+    terms_.emplace_back(store(s), s.size());
+    hashes_.push_back(h);
+    slots_[i] = id;
+    if (terms_.size() * 2 > slots_.size()) grow();
+    return id;
+}
+
+size_t TermDict::memory_bytes() const {
+    return block_bytes_ +
+           terms_.capacity() * sizeof(std::string_view) +
+           hashes_.capacity() * sizeof(uint32_t) +
+           slots_.capacity() * sizeof(uint32_t);
+}
+
+void TermDict::clear() {
+    blocks_.clear();
+    block_used_ = kBlockSize;
+    block_bytes_ = 0;
+    terms_.clear();
+    hashes_.clear();
+    slots_.assign(1024, kEmpty);
+}
+
+void TermDict::sorted_ids(std::vector<uint32_t>& out) const {
+    sort_string_ids(terms_, out);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Interns term strings into arena blocks and hands out dense ids. Lookup is
+// an open-addressing table of ids, so a term costs its bytes plus ~16 bytes
+// of bookkeeping instead of a heap-allocated std::string per occurrence.
+class TermDict {
+ public:
+  // Term bytes are stored in arena blocks of this size.
+  static constexpr size_t kBlockSize = 1 << 20;
+
+  TermDict();
+
+  uint32_t intern(std::string_view s);
+  std::string_view term(uint32_t id) const { return terms_[id]; }
+  size_t size() const { return terms_.size(); }
+  size_t memory_bytes() const;
+  void clear();
+
+  // Ids ordered by term bytes.
+  void sorted_ids(std::vector<uint32_t>& out) const;
+
+ private:
+  static constexpr uint32_t kEmpty = 0xFFFFFFFFu;
+
+  const char* store(std::string_view s);
+  void grow();
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  size_t block_used_ = kBlockSize;
+  size_t block_bytes_ = 0;
+  std::vector<std::string_view> terms_;
+  std::vector<uint32_t> hashes_;
+  std::vector<uint32_t> slots_;
+};
@@ -1,11 +1,21 @@
 #include "text_tokenizer.h"
 #include "word_stemmer.h"
 #include "fs_utils.h"
-
+#include "run_merge.h"
+#include "stem_cache.h"
+#include "string_sort.h"
+#include "term_counts.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 static bool read_lines(const std::string& path, std::vector<std::string>& out) {
@@ -24,8 +34,8 @@ static std::string make_run_path(const std::string& dir, int idx) {
     return dir + "/run_" + std::to_string(idx) + ".txt";
 }
 
-static bool write_run(const std::string& path, std::vector<std::string>& tokens) {
-    merge_sort_strings(tokens);
+static bool write_run(const std::string& path, std::vector<std::string>& tokens, int threads) {
+    sort_strings(tokens, threads);
     std::ofstream out(path, std::ios::binary);
     if (!out) return false;
     for (const auto& t : tokens) {
@@ -35,15 +45,111 @@ static bool write_run(const std::string& path, std::vector<std::string>& tokens)
     return true;
 }
 
-static bool read_token(std::ifstream& in, std::string& token) {
-    token.clear();
-    return static_cast<bool>(std::getline(in, token));
+struct TokenRun {
+    BufferedReader in;
+    bool valid = false;
+    std::string tok;
+
+    bool next() {
+        valid = in.read_line(tok);
+        return valid;
+    }
+};
+
+static int cmp_token_runs(const TokenRun& a, const TokenRun& b) {
+    return a.tok.compare(b.tok);
+}
+
+static void report_stem_cache(const StemCache* stem_cache) {
+    if (!stem_cache) return;
+    StemCacheStats st = stem_cache->stats();
+    std::cerr << "stem_cache_hits=" << st.hits << " stem_cache_misses=" << st.misses
+              << " stem_cache_hit_rate=" << st.hit_rate() << "\n";
+}
+
+// --mode hash: each worker pulls documents from a shared counter and counts
+// them in its own TermCounter, which spills sorted partials once it outgrows
+// its share of the memory budget. Output lines are term, collection
+// frequency and document frequency.
+struct CountWorker {
+    TermCounter counter;
+    bool ok = true;
+};
+
+static void count_docs(const std::vector<std::string>& doc_paths,
+                       std::atomic<size_t>& next_doc,
+                       bool use_stemming,
+                       StemCache* stem_cache,
+                       CountWorker& w) {
+    TokenizerConfig tc;
+    Tokenizer tokenizer(tc);
+    RussianStemmer stemmer;
+
+    std::string text;
+    std::vector<std::string> tokens;
+    while (true) {
+        size_t doc = next_doc.fetch_add(1);
+        if (doc >= doc_paths.size()) break;
+        if (!read_file_utf8(doc_paths[doc], text)) continue;
+
+        tokenizer.tokenize(text, tokens);
+        if (use_stemming) {
+            for (auto& t : tokens) {
+                if (stem_cache) stem_cache->stem(t);
+                else stemmer.stem(t);
+            }
+        }
+        if (!w.counter.add_doc(tokens, (uint32_t)doc)) {
+            w.ok = false;
+            return;
+        }
+    }
+}
+
+static int count_hash(const std::vector<std::string>& doc_paths,
+                      const std::string& output_path,
+                      const std::string& tmp_dir,
+                      bool use_stemming,
+                      StemCache* stem_cache,
+                      int threads,
+                      size_t mem_bytes) {
+    threads = std::max(1, std::min<int>(threads, (int)doc_paths.size()));
+    size_t counter_bytes = std::max<size_t>(1, mem_bytes / (size_t)threads);
+    std::atomic<size_t> next_doc(0);
+    std::vector<CountWorker> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.push_back({TermCounter(tmp_dir + "/counts_" + std::to_string(t) + "_", counter_bytes)});
+    }
+
+    if (threads == 1) {
+        count_docs(doc_paths, next_doc, use_stemming, stem_cache, workers[0]);
+    } else {
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t) {
+            pool.emplace_back(count_docs, std::cref(doc_paths), std::ref(next_doc), use_stemming, stem_cache,
+                              std::ref(workers[t]));
+        }
+        for (auto& th : pool) th.join();
+    }
+    report_stem_cache(stem_cache);
+
+    std::vector<TermCounter> counters;
+    for (auto& w : workers) {
+        if (!w.ok) return 3;
+        counters.push_back(std::move(w.counter));
+    }
+    size_t partials = 0;
+    for (const auto& c : counters) partials += c.partial_count();
+    std::cerr << "hash_partials=" << partials << "\n";
+
+    return TermCounter::merge(counters, output_path) ? 0 : 5;
 }
 
 int main(int argc, char** argv) {
     if (argc < 3) {
         std::cerr << "Usage: term_frequency <docs_list.txt> <out_termfreq.tsv> "
-                     "[--stemming 0|1] [--chunk N]\n";
+                     "[--stemming 0|1] [--chunk N] [--stem_cache N] [--threads N] "
+                     "[--mode sort|hash] [--mem_mb N]\n";
         return 1;
     }
 
@@ -52,6 +158,10 @@ int main(int argc, char** argv) {
 
     bool use_stemming = false;
     int chunk_size = 2000000;
+    size_t stem_cache_entries = 0;
+    int threads = 1;
+    bool hash_mode = false;
+    size_t mem_mb = 256;
 
     for (int i = 3; i < argc; ++i) {
         std::string a = argv[i];
@@ -61,6 +171,18 @@ int main(int argc, char** argv) {
         } else if (a == "--chunk" && i + 1 < argc) {
             chunk_size = std::stoi(argv[i + 1]);
             ++i;
+        } else if (a == "--stem_cache" && i + 1 < argc) {
+            stem_cache_entries = std::stoul(argv[i + 1]);
+            ++i;
+        } else if (a == "--threads" && i + 1 < argc) {
+            threads = std::max(1, std::stoi(argv[i + 1]));
+            ++i;
+        } else if (a == "--mode" && i + 1 < argc) {
+            hash_mode = (std::string(argv[i + 1]) == "hash");
+            ++i;
+        } else if (a == "--mem_mb" && i + 1 < argc) {
+            mem_mb = std::max<size_t>(1, std::stoul(argv[i + 1]));
+            ++i;
         }
     }
 
@@ -73,9 +195,8 @@ int main(int argc, char** argv) {
     TokenizerConfig tc;
     Tokenizer tokenizer(tc);
     RussianStemmer stemmer;
-
-    std::vector<std::string> buffer;
-    buffer.reserve(static_cast<size_t>(chunk_size));
+    std::unique_ptr<StemCache> stem_cache;
+    if (use_stemming && stem_cache_entries) stem_cache.reset(new StemCache(stem_cache_entries));
 
     std::string tmp_dir = "tmp_term_frequency";
 
@@ -85,6 +206,14 @@ int main(int argc, char** argv) {
     std::system(("mkdir -p " + tmp_dir).c_str());
 #endif
 
+    if (hash_mode) {
+        return count_hash(doc_paths, output_path, tmp_dir, use_stemming, stem_cache.get(), threads,
+                          mem_mb << 20);
+    }
+
+    std::vector<std::string> buffer;
+    buffer.reserve(static_cast<size_t>(chunk_size));
+
     int run_count = 0;
     std::vector<std::string> tokens;
 
@@ -94,22 +223,27 @@ int main(int argc, char** argv) {
 
         tokenizer.tokenize(text, tokens);
         if (use_stemming) {
-            for (auto& t : tokens) t = stemmer.stem(t);
+            for (auto& t : tokens) {
+                if (stem_cache) stem_cache->stem(t);
+                else stemmer.stem(t);
+            }
         }
 
         for (const auto& t : tokens) {
             buffer.push_back(t);
             if ((int)buffer.size() >= chunk_size) {
                 std::string run_path = make_run_path(tmp_dir, run_count++);
-                if (!write_run(run_path, buffer)) return 3;
+                if (!write_run(run_path, buffer, threads)) return 3;
                 buffer.clear();
             }
         }
     }
 
+    report_stem_cache(stem_cache.get());
+
     if (!buffer.empty()) {
         std::string run_path = make_run_path(tmp_dir, run_count++);
-        if (!write_run(run_path, buffer)) return 3;
+        if (!write_run(run_path, buffer, threads)) return 3;
         buffer.clear();
     }
 
@@ -118,53 +252,22 @@ int main(int argc, char** argv) {
         return 0;
     }
 
-    std::vector<std::ifstream*> inputs;
-    std::vector<std::string> current;
-    inputs.reserve(run_count);
-    current.reserve(run_count);
-
+    std::vector<TokenRun> runs(run_count);
     for (int i = 0; i < run_count; ++i) {
-        auto* f = new std::ifstream(make_run_path(tmp_dir, i), std::ios::binary);
-        if (!(*f)) return 4;
-        inputs.push_back(f);
-        std::string tok;
-        if (read_token(*f, tok)) current.push_back(tok);
-        else current.push_back("");
-    }
-
-    std::vector<char> finished(run_count, 0);
-    for (int i = 0; i < run_count; ++i) {
-        if (!(*inputs[i]) || (current[i].empty() && inputs[i]->eof()))
-            finished[i] = 1;
+        if (!runs[i].in.open(make_run_path(tmp_dir, i))) return 4;
+        runs[i].next();
     }
 
     std::ofstream out(output_path);
     if (!out) return 5;
 
-    auto done = [&]() {
-        for (char f : finished) if (!f) return false;
-        return true;
-    };
+    LoserTree<TokenRun, decltype(&cmp_token_runs)> tree(runs, &cmp_token_runs);
 
     std::string active_term;
     long long active_count = 0;
 
-    while (!done()) {
-        int best = -1;
-        for (int i = 0; i < run_count; ++i) {
-            if (finished[i]) continue;
-            if (best < 0 || current[i] < current[best]) best = i;
-        }
-        if (best < 0) break;
-
-        std::string tok = current[best];
-        std::string next;
-        if (read_token(*inputs[best], next)) {
-            current[best] = next;
-        } else {
-            finished[best] = 1;
-            current[best].clear();
-        }
+    for (int best; (best = tree.top()) >= 0; ) {
+        const std::string& tok = runs[best].tok;
 
         if (active_term.empty()) {
             active_term = tok;
@@ -176,16 +279,14 @@ int main(int argc, char** argv) {
             active_term = tok;
             active_count = 1;
         }
+
+        runs[best].next();
+        tree.replay();
     }
 
     if (!active_term.empty()) {
         out << active_term << "\t" << active_count << "\n";
     }
 
-    for (auto* f : inputs) {
-        f->close();
-        delete f;
-    }
-
     return 0;
 }
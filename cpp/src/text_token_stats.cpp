@@ -1,10 +1,13 @@
 #include "text_tokenizer.h"
 #include "word_stemmer.h"
+#include "stem_cache.h"
 #include "fs_utils.h"
+#include "token_stats.h"
 
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -20,32 +23,24 @@ static bool read_lines(const std::string& path, std::vector<std::string>& out) {
     return true;
 }
 
-static long long bytes_total(const std::vector<std::string>& files) {
-    long long sum = 0;
-    for (const auto& f : files) {
-        std::ifstream in(f, std::ios::binary);
-        if (!in) continue;
-        in.seekg(0, std::ios::end);
-        auto sz = in.tellg();
-        if (sz > 0) sum += static_cast<long long>(sz);
-    }
-    return sum;
-}
-
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::cerr << "Usage: text_token_stats <docs_list.txt> [--stemming 0|1]\n";
+        std::cerr << "Usage: text_token_stats <docs_list.txt> [--stemming 0|1] [--stem_cache N]\n";
         return 1;
     }
 
     std::string list_path = argv[1];
     bool use_stemming = false;
+    size_t stem_cache_entries = 0;
 
     for (int i = 2; i < argc; ++i) {
         std::string a = argv[i];
         if (a == "--stemming" && i + 1 < argc) {
             use_stemming = (std::string(argv[i + 1]) == "1");
             i++;
+        } else if (a == "--stem_cache" && i + 1 < argc) {
+            stem_cache_entries = std::stoul(argv[i + 1]);
+            i++;
         }
     }
 
@@ -63,10 +58,11 @@ int main(int argc, char** argv) {
 
     Tokenizer tokenizer(cfg);
     RussianStemmer stemmer;
+    std::unique_ptr<StemCache> stem_cache;
+    if (use_stemming && stem_cache_entries) stem_cache.reset(new StemCache(stem_cache_entries));
 
     std::vector<std::string> tokens;
-    long long token_count = 0;
-    long long total_token_len_chars = 0;
+    TokenStats st;
 
     auto t0 = std::chrono::steady_clock::now();
 
@@ -76,44 +72,25 @@ int main(int argc, char** argv) {
 
         tokenizer.tokenize(text, tokens);
         if (use_stemming) {
-            for (auto& tok : tokens) tok = stemmer.stem(tok);
-        }
-
-        token_count += static_cast<long long>(tokens.size());
-
-        for (const auto& s : tokens) {
-            int n = 0;
-            for (size_t k = 0; k < s.size();) {
-                unsigned char c = static_cast<unsigned char>(s[k]);
-                if (c < 0x80) {
-                    k += 1;
-                    n += 1;
-                } else if (k + 1 < s.size()) {
-                    k += 2;
-                    n += 1;
-                } else {
-                    break;
-                }
+            for (auto& tok : tokens) {
+                if (stem_cache) stem_cache->stem(tok);
+                else stemmer.stem(tok);
             }
-            total_token_len_chars += n;
         }
+        st.add_doc(text.size(), tokens);
     }
 
     auto t1 = std::chrono::steady_clock::now();
     double sec = std::chrono::duration<double>(t1 - t0).count();
 
-    long long total_bytes = bytes_total(files);
-    double kb = static_cast<double>(total_bytes) / 1024.0;
-    double avg_len = token_count ? static_cast<double>(total_token_len_chars) / token_count : 0.0;
-    double tokens_per_kb = kb > 0 ? static_cast<double>(token_count) / kb : 0.0;
-
-    std::cout << "docs=" << files.size() << "\n";
-    std::cout << "total_bytes=" << total_bytes << "\n";
-    std::cout << "token_count=" << token_count << "\n";
-    std::cout << "avg_token_len_chars=" << avg_len << "\n";
-    std::cout << "time_sec=" << sec << "\n";
-    std::cout << "tokens_per_kb=" << tokens_per_kb << "\n";
-    std::cout << "stemming=" << (use_stemming ? 1 : 0) << "\n";
+    write_token_stats(std::cout, st, files.size(), sec, use_stemming);
+    if (stem_cache) {
+        StemCacheStats st = stem_cache->stats();
+        std::cout << "stem_cache_hits=" << st.hits << "\n";
+        std::cout << "stem_cache_misses=" << st.misses << "\n";
+        std::cout << "stem_cache_bypassed=" << st.bypassed << "\n";
+        std::cout << "stem_cache_hit_rate=" << st.hit_rate() << "\n";
+    }
 
     return 0;
 }
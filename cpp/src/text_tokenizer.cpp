@@ -1,9 +1,93 @@
 #include "text_tokenizer.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TOKENIZER_SSE2 1
+#endif
+
 static inline unsigned char uc(char c) {
     return static_cast<unsigned char>(c);
 }
 
+#ifdef TOKENIZER_SSE2
+
+// Bytes in [lo, lo + n): unsigned range check through a biased signed compare.
+static inline __m128i bytes_in_range(__m128i v, char lo, int n) {
+    __m128i t = _mm_add_epi8(_mm_sub_epi8(v, _mm_set1_epi8(lo)), _mm_set1_epi8(static_cast<char>(0x80)));
+    return _mm_cmplt_epi8(t, _mm_set1_epi8(static_cast<char>(0x80 + n)));
+}
+
+// Appends the ASCII letters and digits starting at i, 16 bytes at a time:
+// each block is lowercased and stored whole, and cur keeps its prefix up to
+// the first other byte. Returns the end of the run, or i near the end of the
+// text where a whole block cannot be loaded.
+static size_t append_ascii_run(const std::string& text, size_t i, bool lowercase, std::string& cur) {
+    while (i + 16 <= text.size()) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+        __m128i upper = bytes_in_range(v, 'A', 26);
+        __m128i word = _mm_or_si128(_mm_or_si128(upper, bytes_in_range(v, 'a', 26)), bytes_in_range(v, '0', 10));
+        if (lowercase) v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(word));
+        size_t n = mask == 0xFFFF ? 16 : static_cast<size_t>(__builtin_ctz(~mask));
+
+        size_t len = cur.size();
+        cur.resize(len + 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&cur[len]), v);
+        cur.resize(len + n);
+        i += n;
+        if (n < 16) break;
+    }
+    return i;
+}
+
+// Same for two-byte Cyrillic letters: each 16-bit lane holds one letter as
+// (second byte << 8 | 0xD0 or 0xD1) and is lowercased and yo-normalized by
+// adding the difference to the target code where the pattern matches. Pairs
+// whose second byte is not a continuation byte end the run and are left to
+// the byte loop.
+static size_t append_cyrillic_run(const std::string& text, size_t i, bool lowercase, bool normalize_yo,
+                                  std::string& cur) {
+    const __m128i low_byte = _mm_set1_epi16(0x00FF);
+    const __m128i high_nibble = _mm_set1_epi16(static_cast<short>(0xF000));
+    while (i + 16 <= text.size()) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+        __m128i letter = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xC0FE))),
+                                         _mm_set1_epi16(static_cast<short>(0x80D0)));
+        if (lowercase) {
+            __m128i d0 = _mm_cmpeq_epi16(_mm_and_si128(v, low_byte), _mm_set1_epi16(0x00D0));
+            __m128i hi = _mm_and_si128(v, high_nibble);
+            __m128i p9 = _mm_and_si128(d0, _mm_cmpeq_epi16(hi, _mm_set1_epi16(static_cast<short>(0x9000))));
+            __m128i pa = _mm_and_si128(d0, _mm_cmpeq_epi16(hi, _mm_set1_epi16(static_cast<short>(0xA000))));
+            __m128i yo = _mm_cmpeq_epi16(v, _mm_set1_epi16(static_cast<short>(0x81D0)));
+            __m128i add = _mm_or_si128(_mm_and_si128(p9, _mm_set1_epi16(0x2000)),
+                                       _mm_and_si128(pa, _mm_set1_epi16(static_cast<short>(0xE001))));
+            add = _mm_or_si128(add, _mm_and_si128(yo, _mm_set1_epi16(0x1001)));
+            v = _mm_add_epi16(v, add);
+        }
+        if (normalize_yo) {
+            __m128i yo = _mm_cmpeq_epi16(v, _mm_set1_epi16(static_cast<short>(0x91D1)));
+            v = _mm_add_epi16(v, _mm_and_si128(yo, _mm_set1_epi16(0x23FF)));
+        }
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(letter));
+        size_t n = mask == 0xFFFF ? 16 : static_cast<size_t>(__builtin_ctz(~mask));
+
+        size_t len = cur.size();
+        cur.resize(len + 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&cur[len]), v);
+        cur.resize(len + n);
+        i += n;
+        if (n < 16) break;
+    }
+    return i;
+}
+
+#else
+
+static size_t append_ascii_run(const std::string&, size_t i, bool, std::string&) { return i; }
+static size_t append_cyrillic_run(const std::string&, size_t i, bool, bool, std::string&) { return i; }
+
+#endif
+
 bool Tokenizer::is_ascii_letter(unsigned char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
 }
@@ -96,6 +180,12 @@ void Tokenizer::tokenize(const std::string& text, std::vector<std::string>& out_
         unsigned char c1 = uc(text[i]);
 
         if (c1 < 0x80) {
+            size_t run_end = append_ascii_run(text, i, cfg_.lowercase, cur);
+            if (run_end != i) {
+                i = run_end;
+                continue;
+            }
+
             if (is_ascii_letter(c1)) {
                 unsigned char x = c1;
                 if (cfg_.lowercase && x >= 'A' && x <= 'Z') {
@@ -130,6 +220,12 @@ void Tokenizer::tokenize(const std::string& text, std::vector<std::string>& out_
             continue;
         }
 
+        size_t run_end = append_cyrillic_run(text, i, cfg_.lowercase, cfg_.normalize_yo, cur);
+        if (run_end != i) {
+            i = run_end;
+            continue;
+        }
+
         if (i + 1 < text.size()) {
             unsigned char c2 = uc(text[i + 1]);
             if (is_cyrillic_pair(c1, c2)) {
@@ -0,0 +1,43 @@
+#include "token_stats.h"
+
+void TokenStats::add_doc(size_t doc_bytes, const std::vector<std::string>& doc_tokens) {
+    bytes += static_cast<long long>(doc_bytes);
+    tokens += static_cast<long long>(doc_tokens.size());
+
+    for (const auto& s : doc_tokens) {
+        int n = 0;
+        for (size_t k = 0; k < s.size();) {
+            unsigned char c = static_cast<unsigned char>(s[k]);
+            if (c < 0x80) {
+                k += 1;
+                n += 1;
+            } else if (k + 1 < s.size()) {
+                k += 2;
+                n += 1;
+            } else {
+                break;
+            }
+        }
+        token_chars += n;
+    }
+}
+
+void TokenStats::add(const TokenStats& o) {
+    bytes += o.bytes;
+    tokens += o.tokens;
+    token_chars += o.token_chars;
+}
+
+void write_token_stats(std::ostream& out, const TokenStats& st, size_t docs, double sec, bool stemming) {
+    double kb = static_cast<double>(st.bytes) / 1024.0;
+    double avg_len = st.tokens ? static_cast<double>(st.token_chars) / st.tokens : 0.0;
+    double tokens_per_kb = kb > 0 ? static_cast<double>(st.tokens) / kb : 0.0;
+
+    out << "docs=" << docs << "\n";
+    out << "total_bytes=" << st.bytes << "\n";
+    out << "token_count=" << st.tokens << "\n";
+    out << "avg_token_len_chars=" << avg_len << "\n";
+    out << "time_sec=" << sec << "\n";
+    out << "tokens_per_kb=" << tokens_per_kb << "\n";
+    out << "stemming=" << (stemming ? 1 : 0) << "\n";
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// What text_token_stats reports, accumulated per thread and added up.
+struct TokenStats {
+  long long bytes = 0;
+  long long tokens = 0;
+  long long token_chars = 0;
+
+  void add_doc(size_t doc_bytes, const std::vector<std::string>& doc_tokens);
+  void add(const TokenStats& o);
+};
+
+// The key=value lines of text_token_stats; docs counts the listed documents.
+void write_token_stats(std::ostream& out, const TokenStats& st, size_t docs, double sec, bool stemming);
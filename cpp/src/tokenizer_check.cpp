@@ -0,0 +1,298 @@
+#include "text_tokenizer.h"
+#include "word_stemmer.h"
+#include "fs_utils.h"
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The byte-at-a-time tokenizer Tokenizer had before the SSE2 word scanners,
+// kept as the reference.
+static bool base_is_letter(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool base_is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int base_utf8_len_chars(const std::string& s) {
+    int n = 0;
+    for (size_t i = 0; i < s.size();) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 0x80) {
+            i += 1;
+            n += 1;
+        } else if (i + 1 < s.size()) {
+            i += 2;
+            n += 1;
+        } else {
+            break;
+        }
+    }
+    return n;
+}
+
+static void base_tokenize(const TokenizerConfig& cfg, const std::string& text, std::vector<std::string>& out) {
+    out.clear();
+    std::string cur;
+
+    auto flush = [&]() {
+        if (cur.empty()) return;
+        if (base_utf8_len_chars(cur) >= cfg.min_len) {
+            bool all_digits = true;
+            for (char ch : cur) {
+                unsigned char c = (unsigned char)ch;
+                if (c >= 0x80 || !base_is_digit(c)) {
+                    all_digits = false;
+                    break;
+                }
+            }
+            if (cfg.keep_numbers || !all_digits) out.push_back(cur);
+        }
+        cur.clear();
+    };
+
+    for (size_t i = 0; i < text.size();) {
+        unsigned char c1 = (unsigned char)text[i];
+
+        if (c1 < 0x80) {
+            if (base_is_letter(c1)) {
+                if (cfg.lowercase && c1 >= 'A' && c1 <= 'Z') c1 = (unsigned char)(c1 - 'A' + 'a');
+                cur.push_back((char)c1);
+                i += 1;
+                continue;
+            }
+            if (base_is_digit(c1)) {
+                cur.push_back((char)c1);
+                i += 1;
+                continue;
+            }
+            if ((c1 == '-' || c1 == '\'') && !cur.empty() && i + 1 < text.size()) {
+                unsigned char n1 = (unsigned char)text[i + 1];
+                if (base_is_letter(n1) || base_is_digit(n1) || n1 >= 0x80) {
+                    cur.push_back((char)c1);
+                    i += 1;
+                    continue;
+                }
+            }
+            flush();
+            i += 1;
+            continue;
+        }
+
+        if (i + 1 < text.size() && (c1 == 0xD0 || c1 == 0xD1)) {
+            unsigned char c2 = (unsigned char)text[i + 1];
+            if (cfg.lowercase) {
+                if (c1 == 0xD0 && c2 == 0x81) {
+                    c1 = 0xD1;
+                    c2 = 0x91;
+                } else if (c1 == 0xD0 && c2 >= 0x90 && c2 <= 0x9F) {
+                    c2 = (unsigned char)(c2 + 0x20);
+                } else if (c1 == 0xD0 && c2 >= 0xA0 && c2 <= 0xAF) {
+                    c1 = 0xD1;
+                    c2 = (unsigned char)(c2 - 0x20);
+                }
+            }
+            if (cfg.normalize_yo && c1 == 0xD1 && c2 == 0x91) {
+                c1 = 0xD0;
+                c2 = 0xB5;
+            }
+            cur.push_back((char)c1);
+            cur.push_back((char)c2);
+            i += 2;
+            continue;
+        }
+
+        flush();
+        i += 1;
+    }
+    flush();
+}
+
+// The suffix-table stemmer RussianStemmer had before the reversed trie, kept
+// as the reference.
+static bool base_remove_longest_suffix(std::string& s, const char* const* sufs, int n) {
+    size_t best_len = 0;
+    for (int i = 0; i < n; ++i) {
+        std::string suf = sufs[i];
+        if (s.size() >= suf.size() && s.compare(s.size() - suf.size(), suf.size(), suf) == 0 &&
+            suf.size() > best_len) {
+            best_len = suf.size();
+        }
+    }
+    if (best_len == 0) return false;
+    s.resize(s.size() - best_len);
+    return true;
+}
+
+static std::string base_stem_one(const std::string& token) {
+    bool russian = false;
+    for (size_t i = 0; i + 1 < token.size(); ++i) {
+        unsigned char c1 = (unsigned char)token[i];
+        if (c1 == 0xD0 || c1 == 0xD1) russian = true;
+    }
+    if (!russian || base_utf8_len_chars(token) <= 3) return token;
+
+    static const char* const suf_verb[] = {
+        "ировавшись","ировались","ировалась","ировало","ировать","ируются","ируется",
+        "авшись","явшись","ившись","ывшись","вшись",
+        "ешь","ишь","ете","ите","ют","ут","ят",
+        "аем","яем","ает","яет","аемся","яются",
+        "ать","ять","ить","еть","уть","ти",
+        "ал","ала","ало","али","ил","ила","ило","или"
+    };
+    static const char* const suf_adj[] = {
+        "ейшего","ейшей","ейшие","ейший",
+        "ого","его","ому","ему",
+        "ыми","ими",
+        "ая","яя","ое","ее","ые","ие",
+        "ой","ей","ым","им","ом","ем",
+        "ую","юю","ых","их"
+    };
+    static const char* const suf_noun[] = {
+        "ирования","ирование","ированиям","ированиях",
+        "ациями","ацией","ация","ации","ацию",
+        "ениями","ением","ение","ения","ению",
+        "остями","остью","ость","остей",
+        "ами","ями","ах","ях",
+        "ов","ев","ей",
+        "ом","ем","ам","ям",
+        "а","я","о","е","ы","и","у","ю","ь"
+    };
+    const std::pair<const char* const*, int> tables[] = {
+        {suf_verb, (int)(sizeof(suf_verb) / sizeof(suf_verb[0]))},
+        {suf_adj, (int)(sizeof(suf_adj) / sizeof(suf_adj[0]))},
+        {suf_noun, (int)(sizeof(suf_noun) / sizeof(suf_noun[0]))},
+    };
+
+    for (const auto& t : tables) {
+        std::string s = token;
+        if (base_remove_longest_suffix(s, t.first, t.second) && base_utf8_len_chars(s) >= 3) return s;
+    }
+    return token;
+}
+
+static std::string base_stem(const std::string& token) {
+    std::string out;
+    size_t start = 0;
+    for (size_t dash; (dash = token.find('-', start)) != std::string::npos; start = dash + 1) {
+        out += base_stem_one(token.substr(start, dash - start));
+        out.push_back('-');
+    }
+    return out + base_stem_one(token.substr(start));
+}
+
+// Random strings around the edges of both: case, yo, dashes, apostrophes,
+// stray UTF-8 lead and continuation bytes, NUL and DEL.
+static void fuzz_texts(size_t n, std::vector<std::string>& out) {
+    std::mt19937 rng(1);
+    const unsigned char alpha[] = {'a', 'Z', '0', '9', '-', '\'', ' ', '.', 0xD0, 0xD1, 0x81, 0x90, 0x9F, 0xA0,
+                                   0xAF, 0xB0, 0xBF, 0x91, 0xB5, 0x80, 0xC3, 0xE2, 0x7F, 0x00, '_', 'A', 'z'};
+    for (size_t k = 0; k < n; ++k) {
+        std::string s;
+        for (int j = (int)(rng() % 80); j > 0; --j) s.push_back((char)alpha[rng() % sizeof(alpha)]);
+        out.push_back(s);
+    }
+}
+
+// Words glued from suffix fragments, hyphens and broken UTF-8.
+static void fuzz_words(size_t n, std::vector<std::string>& out) {
+    std::mt19937 rng(3);
+    const char* pieces[] = {"а", "я", "о", "е", "ы", "и", "у", "ю", "ь", "ировав", "шись", "ей", "ший", "-", "ость",
+                            "ями", "ать", "ого", "x", "\xD0", "\xD1", "\x80", "б", "в", "ан", "ция", "ации", "ени",
+                            "ие", "1", ""};
+    for (size_t k = 0; k < n; ++k) {
+        std::string s;
+        for (int j = (int)(rng() % 7); j > 0; --j) s += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+        out.push_back(s);
+    }
+}
+
+static std::string printable(const std::string& s) {
+    std::string out;
+    for (unsigned char c : s) {
+        if (c < 0x20 || c == 0x7F) out += "\\x" + std::string(1, "0123456789abcdef"[c >> 4]) + "0123456789abcdef"[c & 15];
+        else out.push_back((char)c);
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: tokenizer_check <docs_list.txt> [--docs N] [--fuzz N]\n";
+        return 1;
+    }
+    size_t max_docs = 0;
+    size_t fuzz = 20000;
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--docs" && i + 1 < argc) max_docs = std::stoul(argv[++i]);
+        else if (a == "--fuzz" && i + 1 < argc) fuzz = std::stoul(argv[++i]);
+    }
+
+    std::ifstream list(argv[1]);
+    if (!list) return 2;
+    std::vector<std::string> texts;
+    std::string path, text;
+    while ((!max_docs || texts.size() < max_docs) && std::getline(list, path)) {
+        if (read_file_utf8(trim(path), text)) texts.push_back(text);
+    }
+    size_t docs = texts.size();
+    fuzz_texts(fuzz, texts);
+    std::cout << "docs=" << docs << "\n";
+    std::cout << "fuzz_texts=" << fuzz << "\n";
+
+    // Every combination of the flags, with min_len cycling through 1..3.
+    bool same = true;
+    size_t tokens = 0;
+    std::vector<std::string> ref, got;
+    for (int c = 0; c < 8 && same; ++c) {
+        TokenizerConfig cfg;
+        cfg.lowercase = c & 1;
+        cfg.normalize_yo = c & 2;
+        cfg.keep_numbers = !(c & 4);
+        cfg.min_len = 1 + c % 3;
+        Tokenizer tokenizer(cfg);
+        for (const auto& t : texts) {
+            base_tokenize(cfg, t, ref);
+            tokenizer.tokenize(t, got);
+            tokens += ref.size();
+            if (got != ref) {
+                std::cout << "tokenizer_mismatch config=" << c << " text=" << printable(t.substr(0, 200)) << "\n";
+                same = false;
+                break;
+            }
+        }
+    }
+    std::cout << "tokens_compared=" << tokens << "\n";
+
+    // Stemming goes over the default tokenizer's output, both overloads.
+    std::vector<std::string> words;
+    Tokenizer tokenizer{TokenizerConfig()};
+    for (size_t d = 0; d < docs; ++d) {
+        tokenizer.tokenize(texts[d], got);
+        words.insert(words.end(), got.begin(), got.end());
+    }
+    fuzz_words(fuzz * 15, words);
+    RussianStemmer stemmer;
+    size_t stems = 0;
+    for (const auto& w : words) {
+        if (!same) break;
+        std::string expected = base_stem(w);
+        std::string in_place = w;
+        stemmer.stem(in_place);
+        if (stemmer.stem(std::as_const(w)) != expected || in_place != expected) {
+            std::cout << "stemmer_mismatch word=" << printable(w) << " expected=" << printable(expected) << "\n";
+            same = false;
+        }
+        ++stems;
+    }
+    std::cout << "stems_compared=" << stems << "\n";
+
+    std::cout << "same=" << (same ? 1 : 0) << "\n";
+    return same ? 0 : 3;
+}
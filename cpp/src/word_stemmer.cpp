@@ -1,141 +1,169 @@
 #include "word_stemmer.h"
-#include <vector>
+#include <cstdint>
 #include <string>
 
-static inline unsigned char uc(char c) {
+static constexpr unsigned char uc(char c) {
     return static_cast<unsigned char>(c);
 }
 
-static void split_by_char(const std::string& s, char delim, std::vector<std::string>& out) {
-    out.clear();
-    std::string cur;
-    for (char c : s) {
-        if (c == delim) {
-            out.push_back(cur);
-            cur.clear();
-        } else {
-            cur.push_back(c);
+static constexpr const char* kVerbSuffixes[] = {
+    "ировавшись","ировались","ировалась","ировало","ировать","ируются","ируется",
+    "авшись","явшись","ившись","ывшись","вшись",
+    "ешь","ишь","ете","ите","ют","ут","ят",
+    "аем","яем","ает","яет","аемся","яются",
+    "ать","ять","ить","еть","уть","ти",
+    "ал","ала","ало","али","ил","ила","ило","или"
+};
+
+static constexpr const char* kAdjSuffixes[] = {
+    "ейшего","ейшей","ейшие","ейший",
+    "ого","его","ому","ему",
+    "ыми","ими",
+    "ая","яя","ое","ее","ые","ие",
+    "ой","ей","ым","им","ом","ем",
+    "ую","юю","ых","их"
+};
+
+static constexpr const char* kNounSuffixes[] = {
+    "ирования","ирование","ированиям","ированиях",
+    "ациями","ацией","ация","ации","ацию",
+    "ениями","ением","ение","ения","ению",
+    "остями","остью","ость","остей",
+    "ами","ями","ах","ях",
+    "ов","ев","ей",
+    "ом","ем","ам","ям",
+    "а","я","о","е","ы","и","у","ю","ь"
+};
+
+struct SuffixTable {
+    const char* const* suffixes;
+    int n;
+};
+
+// In the order they are tried: the longest suffix of the first table whose
+// removal leaves at least 3 letters is cut.
+static constexpr SuffixTable kSuffixTables[] = {
+    {kVerbSuffixes, (int)(sizeof(kVerbSuffixes) / sizeof(kVerbSuffixes[0]))},
+    {kAdjSuffixes, (int)(sizeof(kAdjSuffixes) / sizeof(kAdjSuffixes[0]))},
+    {kNounSuffixes, (int)(sizeof(kNounSuffixes) / sizeof(kNounSuffixes[0]))},
+};
+static constexpr int kTables = (int)(sizeof(kSuffixTables) / sizeof(kSuffixTables[0]));
+
+static constexpr int count_suffix_bytes() {
+    bool seen[256] = {};
+    int n = 0;
+    for (const auto& t : kSuffixTables) {
+        for (int i = 0; i < t.n; ++i) {
+            for (const char* p = t.suffixes[i]; *p; ++p) {
+                if (!seen[uc(*p)]) ++n;
+                seen[uc(*p)] = true;
+            }
         }
     }
-    out.push_back(cur);
+    return n;
 }
 
-bool RussianStemmer::ends_with(const std::string& s, const std::string& suf) {
-    if (s.size() < suf.size()) return false;
-    return s.compare(s.size() - suf.size(), suf.size(), suf) == 0;
+static constexpr int kSuffixSymbols = count_suffix_bytes();
+// Enough for the tables above; building a larger trie fails to compile.
+static constexpr int kMaxSuffixNodes = 512;
+
+// The suffixes of all tables, reversed, in one byte trie. Node 0 is the root,
+// so 0 also means "no child". Walking a word back from its last byte passes
+// every suffix it ends with, longer ones later.
+struct SuffixTrie {
+    uint8_t symbol[256];  // byte -> symbol + 1; 0 if no suffix contains it
+    uint16_t next[kMaxSuffixNodes][kSuffixSymbols];
+    uint8_t ends[kMaxSuffixNodes];  // bit t: a suffix of table t ends here
+};
+
+static constexpr SuffixTrie build_suffix_trie() {
+    SuffixTrie trie{};
+    int symbols = 0;
+    int nodes = 1;
+    for (int t = 0; t < kTables; ++t) {
+        for (int i = 0; i < kSuffixTables[t].n; ++i) {
+            const char* s = kSuffixTables[t].suffixes[i];
+            int len = 0;
+            while (s[len]) ++len;
+            int node = 0;
+            for (int k = len - 1; k >= 0; --k) {
+                unsigned char c = uc(s[k]);
+                if (!trie.symbol[c]) trie.symbol[c] = (uint8_t)++symbols;
+                uint16_t& child = trie.next[node][trie.symbol[c] - 1];
+                if (!child) child = (uint16_t)nodes++;
+                node = child;
+            }
+            trie.ends[node] |= (uint8_t)(1 << t);
+        }
+    }
+    return trie;
 }
 
-int RussianStemmer::utf8_len_chars(const std::string& s) {
-    int n = 0;
-    for (size_t i = 0; i < s.size();) {
+static constexpr SuffixTrie kSuffixTrie = build_suffix_trie();
+
+int RussianStemmer::utf8_len_chars(const char* s, size_t n) {
+    int chars = 0;
+    for (size_t i = 0; i < n;) {
         unsigned char c = uc(s[i]);
         if (c < 0x80) {
             i += 1;
-            n += 1;
-        } else if (i + 1 < s.size()) {
+            chars += 1;
+        } else if (i + 1 < n) {
             i += 2;
-            n += 1;
+            chars += 1;
         } else {
             break;
         }
     }
-    return n;
+    return chars;
 }
 
-bool RussianStemmer::looks_russian(const std::string& s) {
-    for (size_t i = 0; i + 1 < s.size(); ++i) {
+bool RussianStemmer::looks_russian(const char* s, size_t n) {
+    for (size_t i = 0; i + 1 < n; ++i) {
         unsigned char c1 = uc(s[i]);
         if (c1 == 0xD0 || c1 == 0xD1) return true;
     }
     return false;
 }
 
-bool RussianStemmer::remove_longest_suffix(std::string& s, const char* const* sufs, int n) {
-    int best = -1;
-    int best_len = 0;
-    for (int i = 0; i < n; ++i) {
-        std::string suf = sufs[i];
-        if (ends_with(s, suf) && (int)suf.size() > best_len) {
-            best_len = (int)suf.size();
-            best = i;
+size_t RussianStemmer::suffix_to_remove(const char* s, size_t n) {
+    if (!looks_russian(s, n)) return 0;
+    if (utf8_len_chars(s, n) <= 3) return 0;
+
+    size_t longest[kTables] = {};
+    int node = 0;
+    for (size_t k = 1; k <= n; ++k) {
+        int sym = kSuffixTrie.symbol[uc(s[n - k])];
+        if (!sym) break;
+        node = kSuffixTrie.next[node][sym - 1];
+        if (!node) break;
+        for (int t = 0; t < kTables; ++t) {
+            if (kSuffixTrie.ends[node] >> t & 1) longest[t] = k;
         }
     }
-    if (best >= 0) {
-        s.resize(s.size() - (size_t)best_len);
-        return true;
-    }
-    return false;
-}
 
-std::string RussianStemmer::stem(const std::string& token) const {
-    if (token.empty()) return token;
-
-    size_t pos = token.find('-');
-    if (pos != std::string::npos) {
-        std::vector<std::string> parts;
-        split_by_char(token, '-', parts);
-        std::string out;
-        for (size_t i = 0; i < parts.size(); ++i) {
-            if (i) out.push_back('-');
-            out += stem_one(parts[i]);
-        }
-        return out;
+    for (int t = 0; t < kTables; ++t) {
+        if (longest[t] && utf8_len_chars(s, n - longest[t]) >= 3) return longest[t];
     }
-    return stem_one(token);
+    return 0;
 }
 
-std::string RussianStemmer::stem_one(const std::string& token) const {
-    if (!looks_russian(token)) return token;
-    if (utf8_len_chars(token) <= 3) return token;
-
+std::string RussianStemmer::stem(const std::string& token) const {
     std::string s = token;
+    stem(s);
+    return s;
+}
 
-    static const char* const suf_verb[] = {
-        "ировавшись","ировались","ировалась","ировало","ировать","ируются","ируется",
-        "авшись","явшись","ившись","ывшись","вшись",
-        "ешь","ишь","ете","ите","ют","ут","ят",
-        "аем","яем","ает","яет","аемся","яются",
-        "ать","ять","ить","еть","уть","ти",
-        "ал","ала","ало","али","ил","ила","ило","или"
-    };
-
-    static const char* const suf_adj[] = {
-        "ейшего","ейшей","ейшие","ейший",
-        "ого","его","ому","ему",
-        "ыми","ими",
-        "ая","яя","ое","ее","ые","ие",
-        "ой","ей","ым","им","ом","ем",
-        "ую","юю","ых","их"
-    };
-
-    static const char* const suf_noun[] = {
-        "ирования","ирование","ированиям","ированиях",
-        "ациями","ацией","ация","ации","ацию",
-        "ениями","ением","ение","ения","ению",
-        "остями","остью","ость","остей",
-        "ами","ями","ах","ях",
-        "ов","ев","ей",
-        "ом","ем","ам","ям",
-        "а","я","о","е","ы","и","у","ю","ь"
-    };
-
-    std::string before = s;
-    if (remove_longest_suffix(s, suf_verb, (int)(sizeof(suf_verb) / sizeof(suf_verb[0])))) {
-        if (utf8_len_chars(s) >= 3) return s;
-        s = before;
-    }
-
-    before = s;
-    if (remove_longest_suffix(s, suf_adj, (int)(sizeof(suf_adj) / sizeof(suf_adj[0])))) {
-        if (utf8_len_chars(s) >= 3) return s;
-        s = before;
-    }
-
-    before = s;
-    if (remove_longest_suffix(s, suf_noun, (int)(sizeof(suf_noun) / sizeof(suf_noun[0])))) {
-        if (utf8_len_chars(s) >= 3) return s;
-        s = before;
+// Parts of a hyphenated token are stemmed separately, last first so the cuts
+// do not move the parts still to do.
+void RussianStemmer::stem(std::string& token) const {
+    size_t end = token.size();
+    for (;;) {
+        size_t dash = end ? token.rfind('-', end - 1) : std::string::npos;
+        size_t begin = dash == std::string::npos ? 0 : dash + 1;
+        size_t cut = suffix_to_remove(token.data() + begin, end - begin);
+        if (cut) token.erase(end - cut, cut);
+        if (dash == std::string::npos) return;
+        end = dash;
     }
-
-    return s;
 }
@@ -1,15 +1,17 @@
 #pragma once
+#include <cstddef>
 #include <string>
 
 class RussianStemmer {
  public:
   std::string stem(const std::string& token) const;
+  // Stems token in place, with the same result as the copying overload.
+  void stem(std::string& token) const;
 
  private:
-  static bool ends_with(const std::string& s, const std::string& suf);
-  static int utf8_len_chars(const std::string& s);
-  static bool looks_russian(const std::string& s);
+  static int utf8_len_chars(const char* s, size_t n);
+  static bool looks_russian(const char* s, size_t n);
 
-  static bool remove_longest_suffix(std::string& s, const char* const* sufs, int n);
-  std::string stem_one(const std::string& token) const;
+  // Bytes to cut off the end of the word s[0, n).
+  static size_t suffix_to_remove(const char* s, size_t n);
 };
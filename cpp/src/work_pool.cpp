@@ -0,0 +1,118 @@
+#include "work_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+
+#include <pthread.h>
+#include <signal.h>
+
+struct WorkPool::Batch {
+    struct Slot {
+        std::mutex mu;
+        std::deque<size_t> tasks;
+    };
+
+    const std::function<void(size_t)>* fn = nullptr;
+    std::unique_ptr<Slot[]> slots;
+    size_t nslots = 0;
+    size_t next_slot = 1;  // slot 0 is the caller's; guarded by WorkPool::mu_
+    std::atomic<size_t> left{0};
+    std::mutex done_mu;
+    std::condition_variable done_cv;
+};
+
+// Helpers start with every signal blocked, so SIGINT and SIGTERM always
+// reach a thread that owns them: the server's signalfd, or the default
+// action in the CLI.
+WorkPool::WorkPool(int threads) {
+    sigset_t all, old;
+    sigfillset(&all);
+    ::pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (int i = 1; i < threads; ++i) helpers_.emplace_back([this] { helper(); });
+    ::pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : helpers_) t.join();
+}
+
+void WorkPool::helper() {
+    for (;;) {
+        std::shared_ptr<Batch> b;
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            cv_.wait(lock, [&] { return stop_ || !batches_.empty(); });
+            if (stop_) return;
+            b = batches_.front();
+            slot = b->next_slot++;
+            if (b->next_slot >= b->nslots) batches_.erase(batches_.begin());
+        }
+        work(*b, slot);
+    }
+}
+
+void WorkPool::work(Batch& b, size_t slot) {
+    for (;;) {
+        size_t task = 0;
+        bool got = false;
+        {
+            Batch::Slot& own = b.slots[slot];
+            std::lock_guard<std::mutex> lock(own.mu);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                got = true;
+            }
+        }
+        for (size_t k = 1; !got && k < b.nslots; ++k) {
+            Batch::Slot& other = b.slots[(slot + k) % b.nslots];
+            std::lock_guard<std::mutex> lock(other.mu);
+            if (!other.tasks.empty()) {
+                task = other.tasks.front();
+                other.tasks.pop_front();
+                got = true;
+            }
+        }
+        if (!got) return;
+
+        (*b.fn)(task);
+        if (b.left.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(b.done_mu);
+            b.done_cv.notify_all();
+        }
+    }
+}
+
+void WorkPool::run(size_t n, const std::function<void(size_t)>& fn) {
+    if (helpers_.empty() || n < 2) {
+        for (size_t i = 0; i < n; ++i) fn(i);
+        return;
+    }
+
+    auto b = std::make_shared<Batch>();
+    b->fn = &fn;
+    b->nslots = std::min(n, helpers_.size() + 1);
+    b->slots.reset(new Batch::Slot[b->nslots]);
+    for (size_t i = 0; i < n; ++i) b->slots[i % b->nslots].tasks.push_back(i);
+    b->left = n;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        batches_.push_back(b);
+    }
+    cv_.notify_all();
+
+    work(*b, 0);
+    {
+        std::unique_lock<std::mutex> lock(b->done_mu);
+        b->done_cv.wait(lock, [&] { return b->left == 0; });
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    batches_.erase(std::remove(batches_.begin(), batches_.end(), b), batches_.end());
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool for splitting one request into tasks. run() deals the task
+// indexes round-robin into one deque per participant; each participant pops
+// from the back of its own deque and, once it is empty, steals from the
+// front of the others'. The calling thread takes part, so concurrent run()
+// calls from several request threads all make progress.
+class WorkPool {
+ public:
+  // threads counts the caller: threads - 1 helper threads are started.
+  explicit WorkPool(int threads);
+  ~WorkPool();
+  WorkPool(const WorkPool&) = delete;
+  WorkPool& operator=(const WorkPool&) = delete;
+
+  int threads() const { return (int)helpers_.size() + 1; }
+  // Runs fn(i) for every i in [0, n) and returns when all have finished.
+  void run(size_t n, const std::function<void(size_t)>& fn);
+
+ private:
+  struct Batch;
+
+  void helper();
+  static void work(Batch& b, size_t slot);
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::vector<std::shared_ptr<Batch>> batches_;
+  bool stop_ = false;
+  std::vector<std::thread> helpers_;
+};